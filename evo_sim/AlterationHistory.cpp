@@ -0,0 +1,176 @@
+//
+//  AlterationHistory.cpp
+//  evo_sim
+//
+//  Active fitness alterations of the HerReset family of clones, stored without per division heap allocation.
+//
+
+#include "AlterationHistory.h"
+#include "SlabPool.h"
+#include "main.h"
+#include <random>
+
+using namespace std;
+
+AlterationRing::AlterationRing(){
+    diffs = inline_diffs;
+    capacity = 0;
+    head = 0;
+    count = 0;
+}
+
+AlterationRing::AlterationRing(const AlterationRing& other){
+    diffs = inline_diffs;
+    capacity = 0;
+    head = 0;
+    count = 0;
+    *this = other;
+}
+
+AlterationRing& AlterationRing::operator=(const AlterationRing& other){
+    if (this == &other){
+        return *this;
+    }
+    if (capacity != other.capacity){
+        setCapacity(other.capacity);
+    }
+    head = 0;
+    count = 0;
+    for (int i=0; i<other.count; i++){
+        push(other.diffs[(other.head + i) % other.capacity]);
+    }
+    return *this;
+}
+
+AlterationRing::~AlterationRing(){
+    release();
+}
+
+void AlterationRing::release(){
+    if (diffs != inline_diffs){
+        if (slab_pool){
+            slab_pool->deallocate(diffs, capacity * sizeof(double));
+        }
+        else{
+            ::operator delete(diffs);
+        }
+        diffs = inline_diffs;
+    }
+}
+
+void AlterationRing::setCapacity(int num){
+    release();
+    capacity = num > 0 ? num : 1;
+    if (capacity > INLINE_CAPACITY){
+        if (slab_pool){
+            diffs = (double *)slab_pool->allocate(capacity * sizeof(double));
+        }
+        else{
+            diffs = (double *)::operator new(capacity * sizeof(double));
+        }
+    }
+    head = 0;
+    count = 0;
+}
+
+void *AlterationList::Node::operator new(size_t size){
+    if (slab_pool){
+        return slab_pool->allocate(size);
+    }
+    return ::operator new(size);
+}
+
+void AlterationList::Node::operator delete(void *block, size_t size){
+    if (slab_pool){
+        slab_pool->deallocate(block, size);
+    }
+    else{
+        ::operator delete(block);
+    }
+}
+
+AlterationList::AlterationList(){
+    head = NULL;
+    count = 0;
+}
+
+AlterationList::AlterationList(const AlterationList& other){
+    head = other.head;
+    count = other.count;
+    if (head){
+        head->refs++;
+    }
+}
+
+AlterationList& AlterationList::operator=(const AlterationList& other){
+    if (other.head){
+        other.head->refs++;
+    }
+    release(head);
+    head = other.head;
+    count = other.count;
+    return *this;
+}
+
+AlterationList::~AlterationList(){
+    release(head);
+}
+
+void AlterationList::release(Node *node){
+    while (node && --node->refs == 0){
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+void AlterationList::push(double diff){
+    Node *node = new Node;
+    node->diff = diff;
+    node->refs = 1;
+    node->next = head;
+    head = node;
+    count++;
+}
+
+double AlterationList::removeRandom(double remove_prob, bool is_mult){
+    uniform_real_distribution<double> runif;
+    double removed = is_mult ? 1 : 0;
+    int num_removed = 0;
+    // kept nodes ahead of a removed one are copied onto new_head. the rest of the list stays shared.
+    Node *new_head = NULL;
+    Node **tail = &new_head;
+    Node *uncopied = head;
+    for (Node *curr = head; curr; curr = curr->next){
+        if (runif(*eng) >= remove_prob){
+            continue;
+        }
+        if (is_mult){
+            removed *= curr->diff;
+        }
+        else{
+            removed += curr->diff;
+        }
+        num_removed++;
+        for (Node *keep = uncopied; keep != curr; keep = keep->next){
+            Node *copy = new Node;
+            copy->diff = keep->diff;
+            copy->refs = 1;
+            copy->next = NULL;
+            *tail = copy;
+            tail = &copy->next;
+        }
+        uncopied = curr->next;
+    }
+    if (num_removed == 0){
+        return removed;
+    }
+    *tail = uncopied;
+    if (uncopied){
+        uncopied->refs++;
+    }
+    release(head);
+    head = new_head;
+    count -= num_removed;
+    return removed;
+}
@@ -0,0 +1,89 @@
+//
+//  AlterationHistory.h
+//  evo_sim
+//
+//  Active fitness alterations of the HerReset family of clones, stored without per division heap allocation.
+//
+
+#ifndef AlterationHistory_h
+#define AlterationHistory_h
+
+#include <stdio.h>
+
+using namespace std;
+
+class AlterationRing{
+    /* FIFO of the alterations of a cell with a fixed alteration lifetime (HerResetClone, HerResetEmpiricClone).
+     holds at most the capacity given to setCapacity, in place for short lifetimes and in one slab pool block otherwise, so copying a ring into a daughter never goes through malloc.
+     */
+private:
+    static const int INLINE_CAPACITY = 6;
+    double inline_diffs[INLINE_CAPACITY];
+    // inline_diffs, or a block of capacity doubles
+    double *diffs;
+    int capacity;
+    // position of the oldest alteration
+    int head;
+    int count;
+    void release();
+public:
+    AlterationRing();
+    AlterationRing(const AlterationRing& other);
+    AlterationRing& operator=(const AlterationRing& other);
+    ~AlterationRing();
+
+    // empties the ring and makes room for num alterations
+    void setCapacity(int num);
+
+    int size(){
+        return count;
+    }
+    double front(){
+        return diffs[head];
+    }
+    void pop(){
+        head = (head + 1) % capacity;
+        count--;
+    }
+    // the ring must not be full
+    void push(double diff){
+        diffs[(head + count) % capacity] = diff;
+        count++;
+    }
+};
+
+class AlterationList{
+    /* alterations of a cell with exponentially distributed alteration lifetimes (HerResetExpClone).
+     an immutable, reference counted list: a daughter shares the whole list with its mother, and removing alterations copies only the nodes ahead of the last one removed. nodes come from the slab pool.
+     */
+private:
+    struct Node{
+        double diff;
+        int refs;
+        Node *next;
+        static void *operator new(size_t size);
+        static void operator delete(void *block, size_t size);
+    };
+    // newest alteration first
+    Node *head;
+    int count;
+    static void release(Node *node);
+public:
+    AlterationList();
+    AlterationList(const AlterationList& other);
+    AlterationList& operator=(const AlterationList& other);
+    ~AlterationList();
+
+    int size(){
+        return count;
+    }
+    void push(double diff);
+
+    /* removes each alteration independently with probability remove_prob.
+     @param is_mult alterations multiply the birth rate instead of adding to it
+     @return product (is_mult) or sum of the removed alterations, 1 or 0 if none were removed
+     */
+    double removeRandom(double remove_prob, bool is_mult);
+};
+
+#endif /* AlterationHistory_h */
@@ -17,28 +17,45 @@
 #include <chrono>
 #include <cstdlib>
 #include <algorithm>
+#include <limits>
+#include <map>
+#include <typeinfo>
 using namespace std;
 
 CList::CList(double death, MutationHandler& mut_handle, int max){
     d = death;
-    tot_rate = 0;
+    tot_rate.set(0);
+    tot_death.set(0);
     time = 0;
     max_types = max;
     num_types = 0;
-    curr_types.reserve(max);
     clearClones();
     tot_cell_count = 0;
     mut_model = &mut_handle;
     root = NULL;
     end_node = NULL;
     death_var = false;
-    recalc_birth = false;
+    rebuild_interval = 1000000;
+    events_since_rebuild = 0;
+    num_rebuilds = 0;
+    max_drift = 0;
+    rate_bin_width = 0;
+    rate_bins_log = false;
+    compact_limit = 10000;
+    next_compaction = compact_limit;
+    prune_interval = 0;
+    events_since_prune = 0;
     prev_fit = 0;
     new_fit = 0;
+    sampler = NULL;
+    sampler_stale = false;
+    active_root = NULL;
+    slab_pool = &clone_pool;
 }
 
 CList::CList(){
-    tot_rate = 0;
+    tot_rate.set(0);
+    tot_death.set(0);
     time = 0;
     num_types = 0;
     tot_cell_count = 0;
@@ -47,23 +64,62 @@ CList::CList(){
     mut_model = NULL;
     d = 0;
     death_var = false;
-    recalc_birth = false;
+    rebuild_interval = 1000000;
+    events_since_rebuild = 0;
+    num_rebuilds = 0;
+    max_drift = 0;
+    rate_bin_width = 0;
+    rate_bins_log = false;
+    compact_limit = 10000;
+    next_compaction = compact_limit;
+    prune_interval = 0;
+    events_since_prune = 0;
     prev_fit = 0;
     new_fit = 0;
     new_type = 0;
+    sampler = NULL;
+    sampler_stale = false;
+    active_root = NULL;
+    slab_pool = &clone_pool;
+}
+
+CList::~CList(){
+    // the types and clones of the last trial were allocated from clone_pool, so they are deleted into it before it goes
+    SlabPool *prev_pool = slab_pool;
+    slab_pool = &clone_pool;
+    resetPopulation();
+    if (sampler){
+        delete sampler;
+    }
+    slab_pool = prev_pool == &clone_pool ? NULL : prev_pool;
 }
 
 void CList::clearClones(){
-    curr_types.clear();
-    for (int i = 0; i < max_types; i++){
-        curr_types.push_back(NULL);
-    }
+    curr_types.setCapacity(max_types);
 }
 
 void CList::refreshSim(){
+    resetPopulation();
+    // every type and clone of the previous run was deleted. this also drops blocks of clones that were never inserted.
+    clone_pool.releaseAll();
+}
+
+void CList::resetPopulation(){
+    // deleted types must not unlink themselves from the active list
+    while (active_root){
+        deactivateType(*active_root);
+    }
     deleteList();
     clearClones();
-    tot_rate = 0;
+    phylogeny.clear();
+    prune_candidates.clear();
+    events_since_prune = 0;
+    tot_rate.set(0);
+    tot_death.set(0);
+    events_since_rebuild = 0;
+    num_rebuilds = 0;
+    max_drift = 0;
+    next_compaction = compact_limit;
     time = 0;
     tot_cell_count = 0;
     num_types = 0;
@@ -74,6 +130,12 @@ void CList::refreshSim(){
     prev_fit = 0;
     new_fit = 0;
     new_type = 0;
+    clone_slots.clear();
+    free_slots.clear();
+    if (sampler){
+        sampler->clear();
+    }
+    sampler_stale = false;
 }
 
 void SexReprPop::refreshSim(){
@@ -82,51 +144,179 @@ void SexReprPop::refreshSim(){
 }
 
 void CList::insertCellType(CellType& new_type) {
-    if (curr_types[new_type.getIndex()]){
+    if (curr_types.get(new_type.getIndex())){
         throw "type space conflict";
     }
+    if (!new_type.clone_list){
+        // root type. mutants were added to the phylogeny by their constructor.
+        phylogeny.addNode(new_type.getIndex(), Phylogeny::NONE);
+    }
     if (end_node){
         end_node->setNext(new_type);
     }
     else{
         root = &new_type;
     }
-    curr_types[new_type.getIndex()] = &new_type;
+    curr_types.set(new_type.getIndex(), &new_type);
     new_type.setPrev(*end_node);
     end_node = &new_type;
-    addCells(new_type.getNumCells(), new_type.getBirthRate());
+    new_type.birth_time = time;
     new_type.setCloneList(*this);
+    addCells(new_type.getNumCells(), new_type.getBirthRate(), new_type.getNumCells() * new_type.getDeathRate());
+    if (new_type.getNumCells() > 0){
+        activateType(new_type);
+    }
     num_types++;
 }
 
+void CList::activateType(CellType& type){
+    if (type.is_active){
+        return;
+    }
+    type.is_active = true;
+    type.active_prev = NULL;
+    type.active_next = active_root;
+    if (active_root){
+        active_root->active_prev = &type;
+    }
+    active_root = &type;
+}
+
+void CList::deactivateType(CellType& type){
+    if (!type.is_active){
+        return;
+    }
+    type.is_active = false;
+    type.extinct_time = time;
+    if (prune_interval > 0 && !type.prune_queued){
+        type.prune_queued = true;
+        prune_candidates.push_back(&type);
+    }
+    if (type.active_prev){
+        type.active_prev->active_next = type.active_next;
+    }
+    else{
+        active_root = type.active_next;
+    }
+    if (type.active_next){
+        type.active_next->active_prev = type.active_prev;
+    }
+    type.active_prev = NULL;
+    type.active_next = NULL;
+}
+
 void CList::deleteList()
 {
     CellType *to_delete = root;
-    CellType *next = to_delete->getNext();
-    while(next) {
-        to_delete = next;
-        next = to_delete->getNext();
+    while(to_delete) {
+        CellType *next = to_delete->getNext();
         delete to_delete;
+        to_delete = next;
     }
     
 }
 
+void CList::emptyTypes(){
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        // each clone removes itself from the back of the arrays
+        while (!curr_type->clones.empty()){
+            Clone *last = curr_type->clones.back();
+            last->removeCells(last->getCellCount());
+        }
+    }
+}
+
 double CList::getTotalBirth(){
-    if (recalc_birth){
-        CellType *rep_type = root;
-        while (rep_type->getNumCells() == 0){
-            rep_type = rep_type->getNext();
+    return tot_rate.get();
+}
+
+void CList::cloneInserted(Clone& clone){
+    int slot;
+    if (free_slots.empty()){
+        slot = clone_slots.size();
+        clone_slots.push_back(&clone);
+    }
+    else{
+        slot = free_slots.back();
+        free_slots.pop_back();
+        clone_slots[slot] = &clone;
+    }
+    clone.setPopSlot(slot);
+    if (sampler && !sampler_stale){
+        indexClone(clone);
+    }
+}
+
+void CList::cloneChanged(Clone& clone){
+    clone.getType().updateClone(clone);
+    if (sampler && !sampler_stale && clone.getPopSlot() >= 0){
+        indexClone(clone);
+    }
+}
+
+void CList::cloneRemoved(Clone& clone){
+    int slot = clone.getPopSlot();
+    if (slot < 0){
+        return;
+    }
+    clone_slots[slot] = NULL;
+    free_slots.push_back(slot);
+    clone.setPopSlot(-1);
+    if (sampler && !sampler_stale){
+        sampler->removeClone(slot);
+    }
+}
+
+void CList::indexClone(Clone& clone){
+    double death = 0;
+    if (death_var){
+        death = clone.getCellCount() * clone.getDeathRate();
+    }
+    sampler->setClone(clone.getPopSlot(), clone.getTotalBirth(), clone.getCellCount(), death);
+}
+
+void CList::refreshSampler(){
+    if (!sampler_stale){
+        return;
+    }
+    sampler->clear();
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (*it){
+            indexClone(**it);
         }
-        Clone *reproducer = rep_type->getRoot();
-        double curr_rate = reproducer->getTotalBirth();
-        while (reproducer->getNextClone()){
-            reproducer = reproducer->getNextClone();
-            curr_rate += reproducer->getTotalBirth();
+    }
+    sampler_stale = false;
+}
+
+double CList::cellDeathRate(Clone& clone){
+    if (death_var){
+        return clone.getDeathRate();
+    }
+    return d;
+}
+
+void CList::executeEvent(vector<Clone *>& clones, double total_rate){
+    uniform_real_distribution<double> runif;
+    double ran = runif(*eng) * total_rate;
+    Clone *chosen = clones.back();
+    bool is_birth = chosen->getTotalBirth() > 0;
+    for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+        double birth = (*it)->getTotalBirth();
+        double death = (*it)->getCellCount() * cellDeathRate(**it);
+        if (ran < birth + death){
+            chosen = *it;
+            is_birth = ran < birth;
+            break;
         }
-        return curr_rate;
+        ran -= birth + death;
+    }
+    if (is_birth){
+        prev_fit = chosen->getBirthRate();
+        chosen->reproduce();
+        new_fit = chosen->getBirthRate();
     }
     else{
-        return tot_rate;
+        killCell(*chosen);
     }
 }
 
@@ -143,7 +333,8 @@ double CList::nextEventTime(){
     uniform_real_distribution<double> runif;
     double total_death = getTotalDeath();
     if (tot_cell_count == 0){
-        tot_rate = 0;
+        tot_rate.set(0);
+        tot_death.set(0);
     }
     double tot_birth = getTotalBirth();
     return -log(runif(*eng))/(tot_birth + total_death);
@@ -153,21 +344,22 @@ void CList::nextEventExecute(){
     uniform_real_distribution<double> runif;
     double total_death = getTotalDeath();
     double total_birth = getTotalBirth();
+    // one draw picks both the kind of event and the clone it happens to
     double b_or_d = runif(*eng)*(total_birth + total_death);
     if (b_or_d < (total_death)){
         if (death_var){
-            Clone& dead = chooseDeadVar(total_death);
+            Clone& dead = chooseDeadVar(b_or_d);
             killCell(dead);
 
         }
         else{
-            Clone& dead = chooseDead();
+            Clone& dead = chooseDead(b_or_d / d);
             killCell(dead);
         }
 
     }
     else{
-        Clone& mother = chooseReproducer();
+        Clone& mother = chooseReproducer(b_or_d - total_death);
         prev_fit = mother.getBirthRate();
         mother.reproduce();
         new_fit = mother.getBirthRate();
@@ -175,6 +367,7 @@ void CList::nextEventExecute(){
             new_type = mut_model->getNewType().getIndex();
         }
     }
+    countEvent();
 }
 
 void CList::advance()
@@ -186,92 +379,319 @@ void CList::advance()
 
 Clone& CList::chooseReproducer(){
     uniform_real_distribution<double> runif;
+    return chooseReproducer(runif(*eng) * getTotalBirth());
+}
+
+Clone& CList::chooseReproducer(double ran){
+    if (sampler){
+        refreshSampler();
+        int slot = sampler->chooseReproducer(ran);
+        if (slot >= 0){
+            return *clone_slots[slot];
+        }
+    }
     
-    double ran = runif(*eng) * getTotalBirth();
-    CellType *rep_type = root;
-    while (rep_type->getNumCells() == 0){
-        rep_type = rep_type->getNext();
+    // skip whole types by their total birth rate, then walk the clones of the chosen type
+    CellType *rep_type = NULL;
+    for (CellType *curr_type = active_root; curr_type; curr_type = curr_type->getNextActive()){
+        rep_type = curr_type;
+        if (ran < curr_type->getBirthRate()){
+            break;
+        }
+        ran -= curr_type->getBirthRate();
     }
-    Clone *reproducer = rep_type->getRoot();
-    double curr_rate = reproducer->getTotalBirth();
-    while (curr_rate < ran && reproducer->getNextClone()){
-        reproducer = reproducer->getNextClone();
-        curr_rate += reproducer->getTotalBirth();
+    const vector<double>& births = rep_type->getCloneBirths();
+    int last = births.size() - 1;
+    int i = 0;
+    double curr_rate = births[0];
+    while (curr_rate <= ran && i < last){
+        i++;
+        curr_rate += births[i];
     }
-    return *reproducer;
+    return rep_type->getClone(i);
 }
 
 double CList::getTotalDeath(){
     if (death_var){
-        CellType *curr_type = root;
-        double total_d = 0;
-        while (curr_type){
-            total_d += curr_type->getDeathRate() * curr_type->getNumCells();
-            curr_type = curr_type->getNext();
-        }
-        return total_d;
+        return tot_death.get();
     }
     else{
         return d*tot_cell_count;
     }
 }
 
-Clone& CList::chooseDeadVar(double total_death){
-    uniform_real_distribution<double> runif;
-    double ran = runif(*eng);
-    CellType *dead_type = root;
-    while (dead_type->getNumCells() == 0){
-        dead_type = dead_type->getNext();
-    }
-    ran = ran * total_death;
-    Clone *dead = dead_type->getRoot();
-    double curr_rate = dead->getCellCount() * dead->getDeathRate();
-    while (curr_rate < ran && dead->getNextClone()){
-        dead = dead->getNextClone();
-        curr_rate += dead->getCellCount() * dead->getDeathRate();
+Clone& CList::chooseDeadVar(double ran){
+    if (sampler){
+        refreshSampler();
+        int slot = sampler->chooseByDeath(ran);
+        if (slot >= 0){
+            return *clone_slots[slot];
+        }
     }
-    return *dead;
-
+    CellType *dead_type = NULL;
+    for (CellType *curr_type = active_root; curr_type; curr_type = curr_type->getNextActive()){
+        dead_type = curr_type;
+        if (ran < curr_type->getNumCells() * curr_type->getDeathRate()){
+            break;
+        }
+        ran -= curr_type->getNumCells() * curr_type->getDeathRate();
+    }
+    // every clone of a type shares its death rate
+    const vector<long long>& counts = dead_type->getCloneCounts();
+    double death_rate = dead_type->getDeathRate();
+    int last = counts.size() - 1;
+    int i = 0;
+    double curr_rate = counts[0] * death_rate;
+    while (curr_rate <= ran && i < last){
+        i++;
+        curr_rate += counts[i] * death_rate;
+    }
+    return dead_type->getClone(i);
 }
 
 Clone& CList::chooseDead(){
     uniform_real_distribution<double> runif;
-    double ran = runif(*eng);
-    CellType *dead_type = root;
-    while (dead_type->getNumCells() == 0){
-        dead_type = dead_type->getNext();
+    return chooseDead(runif(*eng) * tot_cell_count);
+}
+
+Clone& CList::chooseDead(double ran){
+    if (sampler){
+        refreshSampler();
+        int slot = sampler->chooseByCount(ran);
+        if (slot >= 0){
+            return *clone_slots[slot];
+        }
     }
-    ran = ran * tot_cell_count;
-    
-    Clone *dead = dead_type->getRoot();
-    double curr_rate = dead->getCellCount();
-    while (curr_rate < ran && dead->getNextClone()){
-        dead = dead->getNextClone();
-        curr_rate += dead->getCellCount();
+    CellType *dead_type = NULL;
+    for (CellType *curr_type = active_root; curr_type; curr_type = curr_type->getNextActive()){
+        dead_type = curr_type;
+        if (ran < curr_type->getNumCells()){
+            break;
+        }
+        ran -= curr_type->getNumCells();
     }
-    return *dead;
-    
+    const vector<long long>& counts = dead_type->getCloneCounts();
+    int last = counts.size() - 1;
+    int i = 0;
+    double curr_rate = counts[0];
+    while (curr_rate <= ran && i < last){
+        i++;
+        curr_rate += counts[i];
+    }
+    return dead_type->getClone(i);
 }
 
 int CList::getNextType(){
-    for (int i=0; i < max_types; i++){
-        if (!curr_types[i]){
-            return i;
-        }
+    int i = curr_types.nextFree();
+    if (i < 0){
+        throw "tried to get a new type at max_types";
     }
-    throw "tried to get a new type at max_types";
+    return i;
 }
 
-void CList::addCells(int num_cells, double b){
-    tot_rate += b;
+void CList::addCells(int num_cells, double b, double death){
+    tot_rate.add(b);
+    tot_death.add(death);
     tot_cell_count += num_cells;
 }
 
-void CList::removeCell(double b){
-    tot_rate -= b;
+void CList::removeCell(double b, double death){
+    tot_rate.add(-b);
+    tot_death.add(-death);
     tot_cell_count --;
 }
 
+void CList::removeCells(int num_cells, double b, double death){
+    tot_rate.add(-b);
+    tot_death.add(-death);
+    tot_cell_count -= num_cells;
+}
+
+void CList::deathRatesChanged(){
+    sampler_stale = true;
+    recalcTotalDeath();
+}
+
+void CList::recalcTotalDeath(){
+    CompensatedSum total;
+    CellType *curr_type = root;
+    while (curr_type){
+        total.add(curr_type->getDeathRate() * curr_type->getNumCells());
+        curr_type = curr_type->getNext();
+    }
+    tot_death.set(total.get());
+}
+
+void CList::countEvent(){
+    events_since_rebuild++;
+    if (rebuild_interval > 0 && events_since_rebuild >= rebuild_interval){
+        rebuildRates();
+    }
+    if (rate_bin_width > 0 && getNumClones() > next_compaction){
+        compactClones();
+    }
+    events_since_prune++;
+    if (prune_interval > 0 && events_since_prune >= prune_interval){
+        pruneTypes();
+    }
+}
+
+bool CList::canPrune(CellType& type){
+    return type.num_cells == 0 && type.clones.empty() && !phylogeny.hasChildren(type.index) && phylogeny.getParent(type.index) != Phylogeny::NONE && !type.is_root;
+}
+
+void CList::pruneTypes(){
+    vector<CellType *> queue;
+    queue.swap(prune_candidates);
+    while (!queue.empty()){
+        CellType *type = queue.back();
+        queue.pop_back();
+        type->prune_queued = false;
+        if (!canPrune(*type)){
+            // queued again if it regains cells and dies out, or once its last child is freed
+            continue;
+        }
+        if (mut_model && mut_model->has_mut() && &mut_model->getNewType() == type){
+            // writers may still read the mutant type of the last event
+            type->prune_queued = true;
+            prune_candidates.push_back(type);
+            continue;
+        }
+        CellType *parent = type->getParent();
+        pruneType(*type);
+        if (!parent->prune_queued && canPrune(*parent)){
+            parent->prune_queued = true;
+            queue.push_back(parent);
+        }
+    }
+    events_since_prune = 0;
+}
+
+void CList::pruneType(CellType& type){
+    if (spill_file.is_open()){
+        writeTypeRow(spill_file, type);
+        spill_file << ", " << type.getBirthTime() << ", " << type.getExtinctTime() << "\n";
+    }
+    phylogeny.removeNode(type.index);
+    if (root == &type){
+        root = type.next_node;
+    }
+    if (end_node == &type){
+        end_node = type.prev_node;
+    }
+    type.unlinkType();
+    curr_types.release(type.index);
+    num_types--;
+    delete &type;
+}
+
+bool CList::openSpillFile(string filename){
+    if (prune_interval <= 0){
+        return false;
+    }
+    spill_file.open(filename, ios::app);
+    return true;
+}
+
+void CList::closeSpillFile(){
+    if (spill_file.is_open()){
+        spill_file.flush();
+        spill_file.close();
+    }
+}
+
+double CList::binRate(double b, long long& bin){
+    if (!rate_bins_log){
+        bin = floor(b / rate_bin_width);
+        return (bin + 0.5) * rate_bin_width;
+    }
+    if (b <= 0){
+        // non-growing cells get a bin of their own below every log bin
+        bin = numeric_limits<long long>::min();
+        return 0;
+    }
+    bin = floor(log(b) / rate_bin_width);
+    return exp((bin + 0.5) * rate_bin_width);
+}
+
+void CList::compactClones(){
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        if (curr_type->getNumClones() < 2){
+            continue;
+        }
+        // merging removes clones from the type's arrays, so work from a copy
+        vector<Clone *> clones;
+        for (int i=0; i<curr_type->getNumClones(); i++){
+            clones.push_back(&curr_type->getClone(i));
+        }
+        map<pair<long long, double>, Clone *> keepers;
+        for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+            Clone *curr = *it;
+            if (!curr->canMerge()){
+                continue;
+            }
+            long long bin;
+            double rate = binRate(curr->getBirthRate(), bin);
+            pair<long long, double> key(bin, curr->getMutProb());
+            map<pair<long long, double>, Clone *>::iterator found = keepers.find(key);
+            if (found == keepers.end()){
+                curr->setBirthRate(rate);
+                keepers[key] = curr;
+            }
+            else if (typeid(*found->second) == typeid(*curr)){
+                long long num = curr->getCellCount();
+                found->second->addCells(num);
+                curr->removeCells(num);
+            }
+        }
+    }
+    // a population with more occupied bins than the limit would otherwise compact after every event
+    next_compaction = max(compact_limit, 2 * getNumClones());
+}
+
+void CList::rebuildRates(){
+    CompensatedSum birth;
+    CompensatedSum death;
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        CompensatedSum type_birth;
+        // read from the clones themselves so drift in the stored copies cannot hide
+        for (int i=0; i<curr_type->getNumClones(); i++){
+            type_birth.add(curr_type->getClone(i).getTotalBirth());
+        }
+        curr_type->total_birth_rate.set(type_birth.get());
+        birth.add(type_birth.get());
+        death.add(curr_type->getDeathRate() * curr_type->getNumCells());
+    }
+    if (birth.get() > 0){
+        max_drift = max(max_drift, fabs(tot_rate.get() - birth.get()) / birth.get());
+    }
+    if (death_var && death.get() > 0){
+        max_drift = max(max_drift, fabs(tot_death.get() - death.get()) / death.get());
+    }
+    tot_rate.set(birth.get());
+    tot_death.set(death.get());
+    if (sampler && !sampler_stale){
+        // the sampler totals are running sums over the same clones, so a clone that skipped the hooks shows up here
+        double sampler_diff = 0;
+        if (birth.get() > 0){
+            sampler_diff = fabs(sampler->getTotalBirth() - birth.get()) / birth.get();
+        }
+        if (getNumCells() > 0){
+            sampler_diff = max(sampler_diff, fabs(sampler->getTotalCount() - getNumCells()) / getNumCells());
+        }
+        if (death_var && death.get() > 0){
+            sampler_diff = max(sampler_diff, fabs(sampler->getTotalDeath() - death.get()) / death.get());
+        }
+        max_drift = max(max_drift, sampler_diff);
+        if (sampler_diff > 1e-9){
+            // reindex rather than keep choosing from wrong weights
+            sampler_stale = true;
+        }
+    }
+    events_since_rebuild = 0;
+    num_rebuilds++;
+}
+
 /*
 void CList::walkTypesAndWrite(ofstream& outfile, CellType& root){
     outfile << root.getIndex() << ", " << root.isExtinct() << ", ";
@@ -290,16 +710,19 @@ void CList::walkTypesAndWrite(ofstream& outfile, CellType& root){
 }
 */
 
+void CList::writeTypeRow(ofstream& outfile, CellType& type){
+    int i = type.getIndex();
+    outfile << i << ", " << type.getNumCells() << ", " << phylogeny.getMutEffect(i) << ", " << type.getMeanBirthRate() << ", " << phylogeny.getDepth(i) << ", ";
+    if (phylogeny.getParent(i) != Phylogeny::NONE){
+        outfile << phylogeny.getParent(i);
+    }
+}
+
 void CList::walkTypesAndWrite(ofstream& outfile){
-    for (int i=0; i<max_types; i++){
+    for (int i=0; i<getTypeIndexEnd(); i++){
         if (hasCellType(i)){
-            outfile << i << ", " << getTypeByIndex(i)->getNumCells() << ", " << getTypeByIndex(i)->getMutEffect() << ", " << getTypeByIndex(i)->getMeanBirthRate() << ", " << getTypeByIndex(i)->getDepth() << ", ";
-            if (getTypeByIndex(i)->getParent()){
-                outfile << getTypeByIndex(i)->getParent()->getIndex() << endl;
-            }
-            else{
-                outfile << endl;
-            }
+            writeTypeRow(outfile, *getTypeByIndex(i));
+            outfile << endl;
         }
     }
 }
@@ -307,19 +730,71 @@ void CList::walkTypesAndWrite(ofstream& outfile){
 bool CList::handle_line(vector<string>& parsed_line){
     if (parsed_line[0] == "death"){
         d =stod(parsed_line[1]);
+        deathRatesChanged();
     }
     else if (parsed_line[0] == "recalc_birth"){
-        recalc_birth = true;
+        // the rate totals are compensated and rebuilt on a schedule, so rescans are no longer needed. still accepted for old input files.
+    }
+    else if (parsed_line[0] == "rate_rebuild" && parsed_line.size() > 1){
+        //syntax: pop_params rate_rebuild [events between exact rebuilds, 0 for never]
+        rebuild_interval = stoll(parsed_line[1]);
+    }
+    else if (parsed_line[0] == "rate_bins" && parsed_line.size() > 1){
+        //syntax: pop_params rate_bins [log] [bin width] [clone limit]
+        int pos = 1;
+        rate_bins_log = parsed_line[1] == "log";
+        if (rate_bins_log){
+            pos++;
+        }
+        if ((int)parsed_line.size() <= pos){
+            return false;
+        }
+        rate_bin_width = stod(parsed_line[pos]);
+        if (rate_bin_width <= 0){
+            return false;
+        }
+        if ((int)parsed_line.size() > pos + 1){
+            compact_limit = stoi(parsed_line[pos + 1]);
+        }
+        next_compaction = compact_limit;
+    }
+    else if (parsed_line[0] == "prune" && parsed_line.size() > 1){
+        //syntax: pop_params prune [events between passes freeing extinct types, 0 for never]
+        prune_interval = stoll(parsed_line[1]);
     }
     else if(parsed_line[0] == "max_types"){
         max_types =stoi(parsed_line[1]) + 1;
         clearClones();
     }
+    else if(parsed_line[0] == "sampler" && parsed_line.size() > 1){
+        //syntax: pop_params sampler [linear/fenwick/composition/scan/auto]
+        if (sampler){
+            delete sampler;
+            sampler = NULL;
+        }
+        if (parsed_line[1] == "fenwick"){
+            sampler = new CloneSampler(*new FenwickIndex(), *new FenwickIndex(), *new FenwickIndex());
+        }
+        else if (parsed_line[1] == "composition"){
+            sampler = new CloneSampler(*new CompositionIndex(), *new CompositionIndex(), *new CompositionIndex());
+        }
+        else if (parsed_line[1] == "scan"){
+            sampler = new CloneSampler(*new ScanIndex(), *new ScanIndex(), *new ScanIndex());
+        }
+        else if (parsed_line[1] == "auto"){
+            sampler = new CloneSampler(*new AdaptiveIndex(), *new AdaptiveIndex(), *new AdaptiveIndex());
+        }
+        else if (parsed_line[1] != "linear"){
+            return false;
+        }
+        sampler_stale = true;
+    }
     else if(parsed_line[0] == "death_var"){
         death_var = true;
         int type = stoi(parsed_line[1]);
         double death = stod(parsed_line[2]);
         getTypeByIndex(type)->setDeathRate(death);
+        deathRatesChanged();
     }
     else{
         return false;
@@ -381,56 +856,73 @@ bool PassagePop::checkInit(){
 void PassagePop::passage(){
     time = passage_times.front();
     passage_times.pop();
-    int num_to_kill = tot_cell_count - passage_cellnums.front();
-    std::vector<int> cell_idx(tot_cell_count);
-    if (num_to_kill <= 0){
-        passage_cellnums.pop();
+    long long survivors = passage_cellnums.front();
+    passage_cellnums.pop();
+    if (tot_cell_count <= survivors){
         return;
     }
- 
-    for (int i = 0; i < tot_cell_count; i++) {
-        cell_idx[i] = i;
-    }
-    
-    std::random_shuffle(cell_idx.begin(), cell_idx.end());
-    std::vector<int> dead_idx = std::vector<int>(cell_idx.begin(), cell_idx.begin()+num_to_kill);
-    std::sort(dead_idx.begin(), dead_idx.end());
-    std::queue<int> dead_queue;
-    for (vector<int>::iterator it = dead_idx.begin(); it != dead_idx.end(); ++it){
-        dead_queue.push(*it);
-    }
     
-    CellType *dead_type = root;
-    while (dead_type->getNumCells() == 0){
-        dead_type = dead_type->getNext();
+    // the survivors of each clone are hypergeometric given the cells and survivors left after the clones before it
+    long long cells_left = tot_cell_count;
+    for (size_t i=0; i<clone_slots.size() && cells_left > survivors; i++){
+        Clone *clone = clone_slots[i];
+        if (!clone){
+            continue;
+        }
+        long long num_cells = clone->getCellCount();
+        long long kept = drawHypergeometric(cells_left, num_cells, survivors);
+        cells_left -= num_cells;
+        survivors -= kept;
+        if (kept < num_cells){
+            // deletes the clone if none of its cells survive
+            clone->removeCells(num_cells - kept);
+        }
     }
-    
-    Clone *dead = dead_type->getRoot();
-    double curr_clone = dead->getCellCount();
-    std::queue<Clone *> to_kill = std::queue<Clone *>();
-    while(!dead_queue.empty() && dead_queue.front() < curr_clone){
-        to_kill.push(dead);
-        dead_queue.pop();
-    }
-    while (dead->getNextClone() && !dead_queue.empty()){
-        dead = dead->getNextClone();
-        curr_clone += dead->getCellCount();
-        while(!dead_queue.empty() && dead_queue.front() < curr_clone){
-            to_kill.push(dead);
-            dead_queue.pop();
-        }
-    }
-    while(!to_kill.empty()){
-        killCell(*to_kill.front());
-        to_kill.pop();
-    }
-    /*
-    for (int i=0; i<num_to_kill; i++){
-        Clone& dead = chooseDead();
-        killCell(dead);
+}
+
+long long PassagePop::drawHypergeometric(long long total, long long marked, long long draws){
+    long long low = max(0LL, draws - (total - marked));
+    long long high = min(marked, draws);
+    if (low == high){
+        return low;
+    }
+    long long mode = (long long)((draws + 1.0) * (marked + 1.0) / (total + 2.0));
+    mode = min(max(mode, low), high);
+    double mode_prob = exp(lgamma(marked + 1.0) - lgamma(mode + 1.0) - lgamma(marked - mode + 1.0)
+                           + lgamma(total - marked + 1.0) - lgamma(draws - mode + 1.0) - lgamma(total - marked - draws + mode + 1.0)
+                           - lgamma(total + 1.0) + lgamma(draws + 1.0) + lgamma(total - draws + 1.0));
+    uniform_real_distribution<double> runif;
+    double ran = runif(*eng);
+    if (ran < mode_prob){
+        return mode;
+    }
+    ran -= mode_prob;
+    // walk down and up from the mode together, updating the probabilities by their ratios
+    long long down = mode;
+    long long up = mode;
+    double down_prob = mode_prob;
+    double up_prob = mode_prob;
+    // a tail is done at its bound or once its probabilities underflow
+    while ((down > low && down_prob > 0) || (up < high && up_prob > 0)){
+        if (up < high && up_prob > 0){
+            up_prob *= double(marked - up) * (draws - up) / ((up + 1.0) * (total - marked - draws + up + 1.0));
+            up++;
+            if (ran < up_prob){
+                return up;
+            }
+            ran -= up_prob;
+        }
+        if (down > low && down_prob > 0){
+            down_prob *= double(down) * (total - marked - draws + down) / ((marked - down + 1.0) * (draws - down + 1.0));
+            down--;
+            if (ran < down_prob){
+                return down;
+            }
+            ran -= down_prob;
+        }
     }
-    */
-    passage_cellnums.pop();
+    // only reached through rounding in the probabilities
+    return mode;
 }
 
 void PassagePop::advance(){
@@ -464,127 +956,866 @@ bool PassagePop::handle_line(vector<string>& parsed_line){
 
 void MoranPop::advance(){
     mut_model->reset();
-    Clone& dead = chooseDead();
-    killCell(dead);
-    Clone& mother = chooseReproducer();
-    prev_fit = mother.getBirthRate();
-    mother.reproduce();
-    new_fit = mother.getBirthRate();
+    if (!embedded_chain || !advanceChain()){
+        Clone& dead = chooseDead();
+        killCell(dead);
+        Clone& mother = chooseReproducer();
+        prev_fit = mother.getBirthRate();
+        mother.reproduce();
+        new_fit = mother.getBirthRate();
+        time++;
+    }
     if (mut_model->has_mut()){
         new_type = mut_model->getNewType().getIndex();
     }
-    time++;
+    countEvent();
 }
 
-MoranPop::MoranPop() : CList(){}
-
-SexReprPop::SexReprPop() : CList(){
-    std::vector<int> male_types = std::vector<int>();
-    std::vector<int> female_types = std::vector<int>();
-    is_extinct = false;
-}
-
-UpdateAllPop::UpdateAllPop() : CList(){
-    timestep_length = 0;
-}
-
-void UpdateAllPop::advance(){
-    mut_model->reset();
-    std::vector<Clone *> reproducers = std::vector<Clone *>();
-    std::vector<Clone *> dead = std::vector<Clone *>();
-    
-    CellType *curr_type = root;
-    while (curr_type->getNumCells() == 0){
-        curr_type = curr_type->getNext();
-    }
-    Clone *curr = curr_type->getRoot();
-    while (curr->getNextClone()){
-        curr->update(timestep_length);
-        if (curr->hasDied()){
-            dead.push_back(curr);
+bool MoranPop::advanceChain(){
+    vector<Clone *>& clones = chain_clones;
+    clones.clear();
+    double total_birth = 0;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (!*it){
+            continue;
         }
-        else if (curr->hasReproduced()){
-            reproducers.push_back(curr);
+        if (!(*it)->canIntegrate()){
+            return false;
         }
-        curr = curr->getNextClone();
+        clones.push_back(*it);
+        total_birth += (*it)->getTotalBirth();
     }
-    curr->update(timestep_length);
-    if (curr->hasDied()){
-        dead.push_back(curr);
+    
+    // probability that a cell of clone i dies and the event changes the population. the reproducer is chosen after the death, so a clone competes with one cell less.
+    change_probs.resize(clones.size());
+    double change_prob = 0;
+    for (size_t i=0; i<clones.size(); i++){
+        Clone& clone = *clones[i];
+        double left_birth = total_birth - clone.getBirthRate();
+        double same_birth = clone.getBirthRate() * (clone.getCellCount() - 1);
+        change_probs[i] = 0;
+        if (left_birth > 0){
+            change_probs[i] = clone.getCellCount() / double(tot_cell_count) * (left_birth - same_birth * (1 - clone.getMutProb())) / left_birth;
+        }
+        change_prob += change_probs[i];
     }
-    else if (curr->hasReproduced()){
-        reproducers.push_back(curr);
+    if (change_prob <= 0){
+        return false;
     }
-    
-    for (int i=0; i<reproducers.size(); i++){
-        reproducers.back()->reproduce();
-        reproducers.pop_back();
+    if (change_prob < 1){
+        geometric_distribution<long long> rskipped(change_prob);
+        time += rskipped(*eng);
     }
     
-    for (int i=0; i<dead.size(); i++){
-        killCell(*dead.back());
-        dead.pop_back();
+    uniform_real_distribution<double> runif;
+    double ran = runif(*eng) * change_prob;
+    size_t dead = clones.size() - 1;
+    for (size_t i=0; i<clones.size(); i++){
+        if (ran < change_probs[i]){
+            dead = i;
+            break;
+        }
+        ran -= change_probs[i];
+    }
+    double dead_birth = clones[dead]->getBirthRate();
+    long long dead_count = clones[dead]->getCellCount();
+    double dead_mut = clones[dead]->getMutProb();
+    // deletes the clone if it was its last cell
+    killCell(*clones[dead]);
+    if (dead_count == 1){
+        clones[dead] = NULL;
     }
     
-    time += timestep_length;
-}
-
-bool UpdateAllPop::handle_line(vector<string>& parsed_line){
-    if (parsed_line[0] == "timestep"){
-        timestep_length =stod(parsed_line[1]);
+    // given the death, the reproducer is any other clone, or the dead cell's clone when its daughter mutates
+    double mutant_birth = dead_birth * (dead_count - 1) * dead_mut;
+    ran = runif(*eng) * (total_birth - dead_birth * dead_count + mutant_birth);
+    Clone *mother = NULL;
+    bool is_mutant = false;
+    for (size_t i=0; i<clones.size(); i++){
+        double rate = i == dead ? mutant_birth : (clones[i] ? clones[i]->getTotalBirth() : 0);
+        if (rate <= 0){
+            continue;
+        }
+        mother = clones[i];
+        is_mutant = i == dead;
+        if (ran < rate){
+            break;
+        }
+        ran -= rate;
+    }
+    prev_fit = mother->getBirthRate();
+    if (is_mutant){
+        mother->reproduceMutant();
     }
     else{
-        return CList::handle_line(parsed_line);
+        mother->reproduce();
     }
-    
+    new_fit = mother->getBirthRate();
+    time++;
     return true;
 }
 
-bool SexReprPop::handle_line(vector<string>& parsed_line){
-    if (parsed_line[0] == "male_types"){
-        for (int i=1; i<parsed_line.size(); i++){
-            male_types.push_back(stoi(parsed_line[i]));
-        }
-    }
-    else if (parsed_line[0] == "female_types"){
-        for (int i=1; i<parsed_line.size(); i++){
-            female_types.push_back(stoi(parsed_line[i]));
-        }
+MoranPop::MoranPop() : CList(){
+    embedded_chain = false;
+}
+
+bool MoranPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "embedded_chain" && parsed_line.size() > 1){
+        embedded_chain = bool(stoi(parsed_line[1]));
     }
     else{
         return CList::handle_line(parsed_line);
     }
-    
     return true;
 }
 
-void SexReprPop::advance(){
-    mut_model->reset();
-    std::vector<SexReprClone *> new_cells = std::vector<SexReprClone *>();
-    std::vector<int> type_indices = std::vector<int>();
-    for (int i=0; i<tot_cell_count; i++){
-        SexReprClone* mother = &chooseMother();
-        SexReprClone* father = &chooseFather();
-        SexReprClone& new_cell = mother->reproduce(*father);
-        new_cells.push_back(&new_cell);
-        type_indices.push_back(new_cell.getType().getIndex());
-    }
-    double prev_time = time;
-    refreshSim();
-    for (vector<int>::iterator it = male_types.begin(); it != male_types.end(); ++it){
-        CellType *new_type = new CellType(*it, NULL);
-        insertCellType(*new_type);
+MoranSlotPop::MoranSlotPop() : MoranPop(){
+    sampler = new CloneSampler(*new FenwickIndex(), *new FenwickIndex(), *new FenwickIndex());
+    sampler_stale = true;
+}
+
+bool MoranSlotPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "sampler" && parsed_line.size() > 1 && parsed_line[1] == "linear"){
+        return false;
     }
-    for (vector<int>::iterator it = female_types.begin(); it != female_types.end(); ++it){
-        CellType *new_type = new CellType(*it, NULL);
-        insertCellType(*new_type);
+    return MoranPop::handle_line(parsed_line);
+}
+
+void MoranSlotPop::refreshSim(){
+    CList::refreshSim();
+    cells.clear();
+    cell_rank.clear();
+    for (vector<vector<int> >::iterator it = clone_cells.begin(); it != clone_cells.end(); ++it){
+        it->clear();
+    }
+}
+
+Clone& MoranSlotPop::chooseDead(){
+    if (cells.empty()){
+        return CList::chooseDead();
+    }
+    uniform_real_distribution<double> runif;
+    size_t i = runif(*eng) * cells.size();
+    if (i >= cells.size()){
+        i = cells.size() - 1;
+    }
+    return *clone_slots[cells[i]];
+}
+
+void MoranSlotPop::addCellSlots(int slot, long long num){
+    if (slot >= (int)clone_cells.size()){
+        clone_cells.resize(slot + 1);
+    }
+    vector<int>& owned = clone_cells[slot];
+    for (long long i=0; i<num; i++){
+        cell_rank.push_back(owned.size());
+        owned.push_back(cells.size());
+        cells.push_back(slot);
+    }
+}
+
+void MoranSlotPop::removeCellSlots(int slot, long long num){
+    vector<int>& owned = clone_cells[slot];
+    for (long long i=0; i<num; i++){
+        // cells of a clone are interchangeable, so the clone gives up its last listed cell
+        int pos = owned.back();
+        owned.pop_back();
+        int last = cells.size() - 1;
+        if (pos != last){
+            cells[pos] = cells[last];
+            cell_rank[pos] = cell_rank[last];
+            clone_cells[cells[pos]][cell_rank[pos]] = pos;
+        }
+        cells.pop_back();
+        cell_rank.pop_back();
+    }
+}
+
+void MoranSlotPop::syncCellSlots(Clone& clone){
+    int slot = clone.getPopSlot();
+    if (slot < 0){
+        return;
+    }
+    long long held = slot < (int)clone_cells.size() ? clone_cells[slot].size() : 0;
+    if (clone.getCellCount() > held){
+        addCellSlots(slot, clone.getCellCount() - held);
+    }
+    else if (clone.getCellCount() < held){
+        removeCellSlots(slot, held - clone.getCellCount());
+    }
+}
+
+void MoranSlotPop::cloneInserted(Clone& clone){
+    CList::cloneInserted(clone);
+    syncCellSlots(clone);
+}
+
+void MoranSlotPop::cloneChanged(Clone& clone){
+    CList::cloneChanged(clone);
+    syncCellSlots(clone);
+}
+
+void MoranSlotPop::cloneRemoved(Clone& clone){
+    int slot = clone.getPopSlot();
+    if (slot >= 0 && slot < (int)clone_cells.size()){
+        removeCellSlots(slot, clone_cells[slot].size());
+    }
+    CList::cloneRemoved(clone);
+}
+
+WrightFisherPop::WrightFisherPop() : CList(){}
+
+void WrightFisherPop::moranStep(){
+    Clone& dead = chooseDead();
+    killCell(dead);
+    Clone& mother = chooseReproducer();
+    prev_fit = mother.getBirthRate();
+    mother.reproduce();
+    new_fit = mother.getBirthRate();
+    time += 1.0 / tot_cell_count;
+}
+
+void WrightFisherPop::advance(){
+    mut_model->reset();
+    vector<Clone *> parents;
+    double total_birth = 0;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (!*it){
+            continue;
+        }
+        if (!(*it)->canIntegrate()){
+            moranStep();
+            if (mut_model->has_mut()){
+                new_type = mut_model->getNewType().getIndex();
+            }
+            countEvent();
+            return;
+        }
+        parents.push_back(*it);
+        total_birth += (*it)->getTotalBirth();
+    }
+
+    // multinomial offspring counts as a chain of binomials, then the mutants among each clone's offspring
+    long long remaining = tot_cell_count;
+    vector<long long> offspring(parents.size());
+    vector<long long> mutants(parents.size());
+    for (size_t i=0; i<parents.size(); i++){
+        double weight = parents[i]->getTotalBirth();
+        if (i == parents.size() - 1 || weight >= total_birth){
+            offspring[i] = remaining;
+        }
+        else if (remaining > 0 && weight > 0){
+            binomial_distribution<long long> rchosen(remaining, weight / total_birth);
+            offspring[i] = rchosen(*eng);
+        }
+        else{
+            offspring[i] = 0;
+        }
+        remaining -= offspring[i];
+        total_birth -= weight;
+        binomial_distribution<long long> rmutants(offspring[i], parents[i]->getMutProb());
+        mutants[i] = parents[i]->getMutProb() > 0 ? rmutants(*eng) : 0;
+    }
+
+    // mutants first, while every parent still has its cells. a recurrent mutation may add a cell to another parent, so parents are then resized by their change rather than set to a count.
+    vector<long long> change(parents.size());
+    for (size_t i=0; i<parents.size(); i++){
+        change[i] = offspring[i] - mutants[i] - parents[i]->getCellCount();
+    }
+    for (size_t i=0; i<parents.size(); i++){
+        for (long long j=0; j<mutants[i]; j++){
+            parents[i]->reproduceMutant();
+        }
+    }
+    for (size_t i=0; i<parents.size(); i++){
+        if (change[i] > 0){
+            parents[i]->addCells(change[i]);
+        }
+        else if (change[i] < 0){
+            // deletes the clone if none of its cells have offspring
+            parents[i]->removeCells(-change[i]);
+        }
+    }
+    if (mut_model->has_mut()){
+        new_type = mut_model->getNewType().getIndex();
+    }
+    time++;
+    countEvent();
+}
+
+NRMPop::NRMPop() : CList(){
+    firing_key = -1;
+    queue_stale = true;
+}
+
+void NRMPop::refreshSim(){
+    CList::refreshSim();
+    event_queue.clear();
+    rates.clear();
+    firing_key = -1;
+    queue_stale = true;
+}
+
+void NRMPop::deathRatesChanged(){
+    CList::deathRatesChanged();
+    queue_stale = true;
+}
+
+void NRMPop::cloneInserted(Clone& clone){
+    CList::cloneInserted(clone);
+    if (!queue_stale){
+        scheduleClone(clone);
+    }
+}
+
+void NRMPop::cloneChanged(Clone& clone){
+    CList::cloneChanged(clone);
+    if (!queue_stale && clone.getPopSlot() >= 0){
+        scheduleClone(clone);
+    }
+}
+
+void NRMPop::cloneRemoved(Clone& clone){
+    int slot = clone.getPopSlot();
+    if (slot >= 0 && !queue_stale){
+        for (int key = 2*slot; key < 2*slot + 2; key++){
+            event_queue.remove(key);
+            rates[key] = 0;
+            if (key == firing_key){
+                firing_key = -1;
+            }
+        }
+    }
+    CList::cloneRemoved(clone);
+}
+
+void NRMPop::scheduleClone(Clone& clone){
+    int slot = clone.getPopSlot();
+    scheduleReaction(2*slot, clone.getTotalBirth());
+    scheduleReaction(2*slot + 1, clone.getCellCount() * cellDeathRate(clone));
+}
+
+void NRMPop::scheduleReaction(int key, double rate){
+    if (key >= (int)rates.size()){
+        rates.resize(key + 1, 0);
+    }
+    double old_rate = rates[key];
+    rates[key] = rate;
+    if (key == firing_key || rate == old_rate){
+        return;
     }
-    for (int i=0; i<new_cells.size(); i++){
-        SexReprClone* new_cell = new_cells[i];
-        int index = type_indices[i];
-        CellType *new_type = getTypeByIndex(index);
-        new_cell->setType(*new_type);
-        new_cell->getType().insertClone(*new_cell);
+    if (rate <= 0){
+        event_queue.remove(key);
+    }
+    else if (old_rate > 0 && event_queue.contains(key)){
+        // reuse the pending draw: rescale the time left at the old propensity
+        event_queue.update(key, time + (old_rate / rate) * (event_queue.getTime(key) - time));
+    }
+    else{
+        uniform_real_distribution<double> runif;
+        event_queue.update(key, time - log(runif(*eng)) / rate);
+    }
+}
+
+void NRMPop::rebuildQueue(){
+    event_queue.clear();
+    rates.assign(rates.size(), 0);
+    firing_key = -1;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (*it){
+            scheduleClone(**it);
+        }
+    }
+    queue_stale = false;
+}
+
+void NRMPop::advance(){
+    mut_model->reset();
+    if (queue_stale){
+        rebuildQueue();
+    }
+    if (event_queue.empty()){
+        time = numeric_limits<double>::infinity();
+        return;
+    }
+    firing_key = event_queue.top();
+    time = event_queue.topTime();
+    Clone& chosen = *clone_slots[firing_key / 2];
+    if (firing_key % 2 == 0){
+        prev_fit = chosen.getBirthRate();
+        chosen.reproduce();
+        new_fit = chosen.getBirthRate();
+        if (mut_model->has_mut()){
+            new_type = mut_model->getNewType().getIndex();
+        }
+    }
+    else{
+        killCell(chosen);
+    }
+    // the fired reaction always needs a new exponential draw, at whatever propensity the event left it with
+    if (firing_key >= 0){
+        int key = firing_key;
+        double rate = rates[key];
+        firing_key = -1;
+        event_queue.remove(key);
+        rates[key] = 0;
+        scheduleReaction(key, rate);
+    }
+    countEvent();
+}
+
+TauLeapPop::TauLeapPop() : CList(){
+    epsilon = 0.03;
+    leap_threshold = 10;
+}
+
+bool TauLeapPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "tau_epsilon" && parsed_line.size() > 1){
+        epsilon = stod(parsed_line[1]);
+    }
+    else if (parsed_line[0] == "tau_threshold" && parsed_line.size() > 1){
+        leap_threshold = stoi(parsed_line[1]);
+    }
+    else{
+        return CList::handle_line(parsed_line);
+    }
+    return true;
+}
+
+double TauLeapPop::leapTime(vector<Clone *>& leapers){
+    double tau = numeric_limits<double>::infinity();
+    for (vector<Clone *>::iterator it = leapers.begin(); it != leapers.end(); ++it){
+        double birth = (*it)->getTotalBirth();
+        double death = (*it)->getCellCount() * cellDeathRate(**it);
+        // births and deaths are first order, so the allowed change in cell count is epsilon * count
+        double bound = max(epsilon * (*it)->getCellCount(), 1.0);
+        double mean = fabs(birth - death);
+        double var = birth + death;
+        if (mean > 0){
+            tau = min(tau, bound / mean);
+        }
+        if (var > 0){
+            tau = min(tau, bound * bound / var);
+        }
+    }
+    return tau;
+}
+
+bool TauLeapPop::drawLeaps(vector<Clone *>& leapers, double tau){
+    for (vector<Clone *>::iterator it = leapers.begin(); it != leapers.end(); ++it){
+        if (!(*it)->drawLeap(tau, cellDeathRate(**it))){
+            return false;
+        }
+    }
+    return true;
+}
+
+void TauLeapPop::advance(){
+    mut_model->reset();
+    vector<Clone *> leapers;
+    vector<Clone *> critical;
+    double total_rate = 0;
+    double crit_rate = 0;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (!*it){
+            continue;
+        }
+        double rate = (*it)->getTotalBirth() + (*it)->getCellCount() * cellDeathRate(**it);
+        total_rate += rate;
+        if ((*it)->canLeap() && (*it)->getCellCount() >= leap_threshold){
+            leapers.push_back(*it);
+        }
+        else{
+            critical.push_back(*it);
+            crit_rate += rate;
+        }
+    }
+    double tau = leapTime(leapers);
+    // leaping only pays off if it covers several events
+    if (tau < 10 / total_rate){
+        time += nextEventTime();
+        nextEventExecute();
+        return;
+    }
+    uniform_real_distribution<double> runif;
+    double crit_tau = numeric_limits<double>::infinity();
+    if (crit_rate > 0){
+        crit_tau = -log(runif(*eng)) / crit_rate;
+        tau = min(tau, crit_tau);
+    }
+    // a leap that would kill more cells than a clone holds is thrown away and drawn again over half the time.
+    // the critical event waits for a later step if tau drops below its time, which is exact as its time is exponential.
+    while (!drawLeaps(leapers, tau)){
+        tau /= 2;
+        if (tau < 10 / total_rate){
+            time += nextEventTime();
+            nextEventExecute();
+            return;
+        }
+    }
+    if (crit_rate > 0 && crit_tau <= tau){
+        executeEvent(critical, crit_rate);
+    }
+    for (vector<Clone *>::iterator it = leapers.begin(); it != leapers.end(); ++it){
+        (*it)->leap();
+    }
+    if (mut_model->has_mut()){
+        new_type = mut_model->getNewType().getIndex();
+    }
+    time += tau;
+    countEvent();
+}
+
+HybridPop::HybridPop() : CList(){
+    epsilon = 0.01;
+    threshold = 1000;
+}
+
+void HybridPop::refreshSim(){
+    CList::refreshSim();
+    frac_cells.clear();
+}
+
+void HybridPop::cloneRemoved(Clone& clone){
+    int slot = clone.getPopSlot();
+    if (slot >= 0 && slot < (int)frac_cells.size()){
+        frac_cells[slot] = 0;
+    }
+    CList::cloneRemoved(clone);
+}
+
+bool HybridPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "hybrid_threshold" && parsed_line.size() > 1){
+        threshold = stoll(parsed_line[1]);
+    }
+    else if (parsed_line[0] == "hybrid_epsilon" && parsed_line.size() > 1){
+        epsilon = stod(parsed_line[1]);
+    }
+    else{
+        return CList::handle_line(parsed_line);
+    }
+    return true;
+}
+
+double HybridPop::growthRate(Clone& clone){
+    return clone.getBirthRate() * (1 - clone.getMutProb()) - cellDeathRate(clone);
+}
+
+double HybridPop::mutantRate(Clone& clone){
+    return clone.getMutProb() * clone.getTotalBirth();
+}
+
+void HybridPop::grow(vector<Clone *>& integrated, double dt){
+    for (vector<Clone *>::iterator it = integrated.begin(); it != integrated.end(); ++it){
+        int slot = (*it)->getPopSlot();
+        if (slot >= (int)frac_cells.size()){
+            frac_cells.resize(slot + 1, 0);
+        }
+        double size = ((*it)->getCellCount() + frac_cells[slot]) * exp(growthRate(**it) * dt);
+        // the clone is handed back to the stochastic part before it can die out
+        long long new_count = max((long long)floor(size), 1LL);
+        frac_cells[slot] = max(size - new_count, 0.0);
+        long long change = new_count - (*it)->getCellCount();
+        if (change > 0){
+            (*it)->addCells(change);
+        }
+        else if (change < 0){
+            (*it)->removeCells(-change);
+        }
+    }
+}
+
+void HybridPop::advance(){
+    mut_model->reset();
+    vector<Clone *> stochastic;
+    vector<Clone *> integrated;
+    double stoch_rate = 0;
+    double max_growth = 0;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (!*it){
+            continue;
+        }
+        if ((*it)->canIntegrate() && (*it)->getCellCount() >= threshold){
+            integrated.push_back(*it);
+            max_growth = max(max_growth, fabs(growthRate(**it)));
+        }
+        else{
+            if ((*it)->getPopSlot() < (int)frac_cells.size()){
+                frac_cells[(*it)->getPopSlot()] = 0;
+            }
+            stochastic.push_back(*it);
+            stoch_rate += (*it)->getTotalBirth() + (*it)->getCellCount() * cellDeathRate(**it);
+        }
+    }
+    double horizon = numeric_limits<double>::infinity();
+    if (max_growth > 0){
+        horizon = epsilon / max_growth;
+    }
+    // upper bound on the mutant emission rate over the whole step, for thinning
+    double mut_bound = 0;
+    for (vector<Clone *>::iterator it = integrated.begin(); it != integrated.end(); ++it){
+        double growth = growthRate(**it);
+        mut_bound += mutantRate(**it) * (growth > 0 ? exp(growth * horizon) : 1);
+    }
+    uniform_real_distribution<double> runif;
+    double bound = stoch_rate + mut_bound;
+    double step = -log(runif(*eng)) / bound;
+    if (step >= horizon){
+        // no event in this step, only deterministic growth. it still counts toward rebuilds, compaction and pruning.
+        if (horizon < numeric_limits<double>::infinity()){
+            grow(integrated, horizon);
+        }
+        time += horizon;
+    }
+    else{
+        grow(integrated, step);
+        time += step;
+        double ran = runif(*eng) * bound;
+        if (ran < stoch_rate){
+            executeEvent(stochastic, stoch_rate);
+        }
+        else{
+            ran -= stoch_rate;
+            for (vector<Clone *>::iterator it = integrated.begin(); it != integrated.end(); ++it){
+                double rate = mutantRate(**it);
+                if (ran < rate){
+                    (*it)->reproduceMutant();
+                    break;
+                }
+                ran -= rate;
+            }
+            // otherwise the candidate event was thinned out
+        }
+    }
+    if (mut_model->has_mut()){
+        new_type = mut_model->getNewType().getIndex();
+    }
+    countEvent();
+}
+
+JumpPop::JumpPop() : CList(){
+    jump_step = 1;
+}
+
+bool JumpPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "jump_step" && parsed_line.size() > 1){
+        jump_step = stod(parsed_line[1]);
+    }
+    else{
+        return CList::handle_line(parsed_line);
+    }
+    return true;
+}
+
+long long JumpPop::drawCloneSize(long long num_cells, double birth, double death, double t){
+    // each cell founds an independent lineage: extinct with prob alpha, else geometric on 1, 2, ... with ratio beta
+    double alpha;
+    double beta;
+    double growth = birth - death;
+    if (fabs(growth) * t < 1e-9){
+        alpha = death * t / (1 + birth * t);
+        beta = birth * t / (1 + birth * t);
+    }
+    else{
+        double e = exp(growth * t);
+        alpha = death * (e - 1) / (birth * e - death);
+        beta = birth * (e - 1) / (birth * e - death);
+    }
+    binomial_distribution<long long> rsurvive(num_cells, min(max(1 - alpha, 0.0), 1.0));
+    long long survivors = rsurvive(*eng);
+    if (survivors == 0 || beta <= 0){
+        return survivors;
+    }
+    negative_binomial_distribution<long long> rextra(survivors, 1 - min(beta, 1.0));
+    return survivors + rextra(*eng);
+}
+
+double JumpPop::nextMutationTime(vector<Clone *>& clones, double horizon){
+    uniform_real_distribution<double> runif;
+    double target = -log(runif(*eng));
+    // integrated mutation intensity along the expected sizes n*exp(r*s)
+    double intensity_at_horizon = 0;
+    for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+        double rate = (*it)->getMutProb() * (*it)->getTotalBirth();
+        double growth = (*it)->getBirthRate() * (1 - (*it)->getMutProb()) - cellDeathRate(**it);
+        intensity_at_horizon += (growth == 0) ? rate * horizon : rate * (exp(growth * horizon) - 1) / growth;
+    }
+    if (intensity_at_horizon <= target){
+        return horizon;
+    }
+    double low = 0;
+    double high = horizon;
+    for (int i=0; i<60; i++){
+        double mid = (low + high) / 2;
+        double intensity = 0;
+        for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+            double rate = (*it)->getMutProb() * (*it)->getTotalBirth();
+            double growth = (*it)->getBirthRate() * (1 - (*it)->getMutProb()) - cellDeathRate(**it);
+            intensity += (growth == 0) ? rate * mid : rate * (exp(growth * mid) - 1) / growth;
+        }
+        if (intensity < target){
+            low = mid;
+        }
+        else{
+            high = mid;
+        }
+    }
+    return high;
+}
+
+void JumpPop::advance(){
+    mut_model->reset();
+    vector<Clone *> clones;
+    for (vector<Clone *>::iterator it = clone_slots.begin(); it != clone_slots.end(); ++it){
+        if (!*it){
+            continue;
+        }
+        if (!(*it)->canIntegrate()){
+            time += nextEventTime();
+            nextEventExecute();
+            return;
+        }
+        clones.push_back(*it);
+    }
+    double horizon = (floor(time / jump_step) + 1) * jump_step - time;
+    double jump = nextMutationTime(clones, horizon);
+    for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+        double birth = (*it)->getBirthRate() * (1 - (*it)->getMutProb());
+        long long new_count = drawCloneSize((*it)->getCellCount(), birth, cellDeathRate(**it), jump);
+        long long change = new_count - (*it)->getCellCount();
+        if (change > 0){
+            (*it)->addCells(change);
+        }
+        else if (change < 0){
+            // deletes the clone if it died out
+            (*it)->removeCells(-change);
+            if (new_count == 0){
+                *it = NULL;
+            }
+        }
+    }
+    time += jump;
+    if (jump < horizon){
+        uniform_real_distribution<double> runif;
+        double total = 0;
+        for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+            if (*it){
+                total += (*it)->getMutProb() * (*it)->getTotalBirth();
+            }
+        }
+        double ran = runif(*eng) * total;
+        for (vector<Clone *>::iterator it = clones.begin(); it != clones.end(); ++it){
+            if (!*it){
+                continue;
+            }
+            double rate = (*it)->getMutProb() * (*it)->getTotalBirth();
+            if (ran < rate){
+                (*it)->reproduceMutant();
+                break;
+            }
+            ran -= rate;
+        }
+    }
+    if (mut_model->has_mut()){
+        new_type = mut_model->getNewType().getIndex();
+    }
+    countEvent();
+}
+
+SexReprPop::SexReprPop() : CList(){
+    std::vector<int> male_types = std::vector<int>();
+    std::vector<int> female_types = std::vector<int>();
+    is_extinct = false;
+}
+
+UpdateAllPop::UpdateAllPop() : CList(){
+    timestep_length = 0;
+}
+
+void UpdateAllPop::advance(){
+    mut_model->reset();
+    std::vector<Clone *> reproducers = std::vector<Clone *>();
+    std::vector<Clone *> dead = std::vector<Clone *>();
+    
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        for (int i=0; i<curr_type->getNumClones(); i++){
+            Clone *curr = &curr_type->getClone(i);
+            curr->update(timestep_length);
+            if (curr->hasDied()){
+                dead.push_back(curr);
+            }
+            else if (curr->hasReproduced()){
+                reproducers.push_back(curr);
+            }
+        }
+    }
+    
+    for (int i=0; i<reproducers.size(); i++){
+        reproducers.back()->reproduce();
+        reproducers.pop_back();
+    }
+    
+    for (int i=0; i<dead.size(); i++){
+        killCell(*dead.back());
+        dead.pop_back();
+    }
+    
+    time += timestep_length;
+    countEvent();
+}
+
+bool UpdateAllPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "timestep"){
+        timestep_length =stod(parsed_line[1]);
+    }
+    else{
+        return CList::handle_line(parsed_line);
+    }
+    
+    return true;
+}
+
+bool SexReprPop::handle_line(vector<string>& parsed_line){
+    if (parsed_line[0] == "male_types"){
+        for (int i=1; i<parsed_line.size(); i++){
+            male_types.push_back(stoi(parsed_line[i]));
+        }
+    }
+    else if (parsed_line[0] == "female_types"){
+        for (int i=1; i<parsed_line.size(); i++){
+            female_types.push_back(stoi(parsed_line[i]));
+        }
+    }
+    else{
+        return CList::handle_line(parsed_line);
+    }
+    
+    return true;
+}
+
+void SexReprPop::advance(){
+    mut_model->reset();
+    double prev_time = time;
+    if (!mateByTable()){
+        std::vector<SexReprClone *> new_cells = std::vector<SexReprClone *>();
+        std::vector<int> type_indices = std::vector<int>();
+        for (int i=0; i<tot_cell_count; i++){
+            SexReprClone* mother = &chooseMother();
+            SexReprClone* father = &chooseFather();
+            SexReprClone& new_cell = mother->reproduce(*father);
+            new_cells.push_back(&new_cell);
+            type_indices.push_back(new_cell.getType().getIndex());
+        }
+        // the old generation goes. the types keep their storage for the new one.
+        emptyTypes();
+        startGeneration();
+        for (int i=0; i<new_cells.size(); i++){
+            SexReprClone* new_cell = new_cells[i];
+            int index = type_indices[i];
+            CellType *new_type = getTypeByIndex(index);
+            new_cell->setType(*new_type);
+            new_cell->getType().insertClone(*new_cell);
+        }
     }
     bool males_extinct = true;
     bool females_extinct = true;
@@ -598,7 +1829,176 @@ void SexReprPop::advance(){
     }
     is_extinct = males_extinct && females_extinct;
     time = prev_time + 1;
-    recalc_birth = true;
+    // a generation is one birth per cell, so the totals are rebuilt on the rate_rebuild schedule like the event driven engines
+    events_since_rebuild += tot_cell_count;
+    if (rebuild_interval > 0 && events_since_rebuild >= rebuild_interval){
+        rebuildRates();
+    }
+}
+
+void SexReprPop::startGeneration(){
+    // types start over as roots, like new types would
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        phylogeny.setParent(curr_type->getIndex(), Phylogeny::NONE);
+        phylogeny.setDepth(curr_type->getIndex(), 0);
+        phylogeny.setMutEffect(curr_type->getIndex(), 0);
+    }
+    is_extinct = false;
+    for (vector<int>::iterator it = male_types.begin(); it != male_types.end(); ++it){
+        if (!getTypeByIndex(*it)){
+            CellType *new_type = new CellType(*it, NULL);
+            insertCellType(*new_type);
+        }
+    }
+    for (vector<int>::iterator it = female_types.begin(); it != female_types.end(); ++it){
+        if (!getTypeByIndex(*it)){
+            CellType *new_type = new CellType(*it, NULL);
+            insertCellType(*new_type);
+        }
+    }
+}
+
+bool SexReprPop::mateByTable(){
+    SexReprMutation* mut_handle = (SexReprMutation*)mut_model;
+    vector<CellType *> mothers;
+    vector<CellType *> fathers;
+    double mother_birth = 0;
+    double father_birth = 0;
+    for (vector<int>::iterator it = female_types.begin(); it != female_types.end(); ++it){
+        CellType* curr_type = getTypeByIndex(*it);
+        if (curr_type && !curr_type->isExtinct() && curr_type->getBirthRate() > 0){
+            mothers.push_back(curr_type);
+            mother_birth += curr_type->getBirthRate();
+        }
+    }
+    for (vector<int>::iterator it = male_types.begin(); it != male_types.end(); ++it){
+        CellType* curr_type = getTypeByIndex(*it);
+        if (curr_type && !curr_type->isExtinct() && curr_type->getBirthRate() > 0){
+            fathers.push_back(curr_type);
+            father_birth += curr_type->getBirthRate();
+        }
+    }
+    
+    // offspring counts, birth rates and mutation probabilities by type index. every pair needs a table before anything is drawn.
+    vector<vector<double> > pair_probs(mothers.size() * fathers.size());
+    vector<double> births;
+    vector<double> muts;
+    vector<double> pair_muts;
+    vector<bool> has_mut;
+    for (size_t m=0; m<mothers.size(); m++){
+        // a type holds one clone per generation here, so its cells must share one mutation probability
+        double mother_mut = mothers[m]->getClone(0).getMutProb();
+        for (int i=1; i<mothers[m]->getNumClones(); i++){
+            if (mothers[m]->getClone(i).getMutProb() != mother_mut){
+                return false;
+            }
+        }
+        for (size_t f=0; f<fathers.size(); f++){
+            vector<double>& probs = pair_probs[m * fathers.size() + f];
+            if (!mut_handle->offspringTable(mothers[m]->getIndex(), fathers[f]->getIndex(), mother_mut, probs, births, pair_muts)){
+                return false;
+            }
+            if (muts.size() < probs.size()){
+                muts.resize(probs.size(), 0);
+                has_mut.resize(probs.size(), false);
+            }
+            // the same offspring type from pairs with different mutation probabilities would need more than one clone
+            for (size_t i=0; i<probs.size(); i++){
+                if (probs[i] <= 0){
+                    continue;
+                }
+                if (has_mut[i] && muts[i] != pair_muts[i]){
+                    return false;
+                }
+                muts[i] = pair_muts[i];
+                has_mut[i] = true;
+            }
+        }
+    }
+    muts.resize(births.size(), 0);
+    vector<long long> offspring(births.size(), 0);
+    long long remaining = tot_cell_count;
+    double remaining_prob = 1;
+    for (size_t m=0; m<mothers.size(); m++){
+        for (size_t f=0; f<fathers.size(); f++){
+            double pair_prob = mothers[m]->getBirthRate() / mother_birth * fathers[f]->getBirthRate() / father_birth;
+            bool last_pair = m == mothers.size() - 1 && f == fathers.size() - 1;
+            long long pairs = remaining;
+            if (!last_pair && pair_prob < remaining_prob && remaining > 0){
+                binomial_distribution<long long> rpairs(remaining, pair_prob / remaining_prob);
+                pairs = rpairs(*eng);
+            }
+            remaining -= pairs;
+            remaining_prob -= pair_prob;
+            
+            vector<double>& probs = pair_probs[m * fathers.size() + f];
+            if (pairs == 0 || probs.empty()){
+                continue;
+            }
+            size_t last_child = probs.size() - 1;
+            while (last_child > 0 && probs[last_child] <= 0){
+                last_child--;
+            }
+            double left_prob = 1;
+            for (size_t i=0; i<=last_child && pairs > 0; i++){
+                long long children = pairs;
+                if (i < last_child && probs[i] < left_prob){
+                    binomial_distribution<long long> rchildren(pairs, probs[i] / left_prob);
+                    children = rchildren(*eng);
+                }
+                offspring[i] += children;
+                pairs -= children;
+                left_prob -= probs[i];
+            }
+        }
+    }
+    
+    startGeneration();
+    for (CellType *curr_type = root; curr_type; curr_type = curr_type->getNext()){
+        if (curr_type->getIndex() >= (int)offspring.size()){
+            setTypeCells(*curr_type, 0, 0, 0);
+        }
+    }
+    for (size_t i=0; i<offspring.size(); i++){
+        CellType *curr_type = getTypeByIndex(i);
+        if (!curr_type && offspring[i] > 0){
+            curr_type = new CellType(i, NULL);
+            insertCellType(*curr_type);
+        }
+        if (curr_type){
+            setTypeCells(*curr_type, offspring[i], births[i], muts[i]);
+        }
+    }
+    return true;
+}
+
+void SexReprPop::setTypeCells(CellType& type, long long num, double b, double mut){
+    // removeCells deletes each clone it empties
+    while (type.getNumClones() > (num > 0 ? 1 : 0)){
+        Clone *extra = type.getEnd();
+        extra->removeCells(extra->getCellCount());
+    }
+    if (num == 0){
+        return;
+    }
+    if (type.getNumClones() == 0){
+        SexReprClone *new_clone = new SexReprClone(type, b, mut);
+        type.insertClone(*new_clone);
+        if (num > 1){
+            new_clone->addCells(num - 1);
+        }
+        return;
+    }
+    Clone *clone = type.getRoot();
+    if (clone->getBirthRate() != b){
+        clone->setBirthRate(b);
+    }
+    if (num > clone->getCellCount()){
+        clone->addCells(num - clone->getCellCount());
+    }
+    else if (num < clone->getCellCount()){
+        clone->removeCells(clone->getCellCount() - num);
+    }
 }
 
 bool SexReprPop::checkInit(){
@@ -634,15 +2034,15 @@ SexReprClone& SexReprPop::chooseReproducerVector(vector<int> possible_types){
         if (!curr_type || curr_type->isExtinct()){
             continue;
         }
-        reproducer = (SexReprClone*)curr_type->getRoot();
-        curr_rate += reproducer->getTotalBirth();
-        while (curr_rate < ran && reproducer->getNextClone()){
-            if (reproducer->getNextClone()->getType().getIndex() != reproducer->getType().getIndex()){
-                break;
-            }
-            reproducer = (SexReprClone*)reproducer->getNextClone();
-            curr_rate += reproducer->getTotalBirth();
+        const vector<double>& births = curr_type->getCloneBirths();
+        int last = births.size() - 1;
+        int i = 0;
+        curr_rate += births[0];
+        while (curr_rate < ran && i < last){
+            i++;
+            curr_rate += births[i];
         }
+        reproducer = (SexReprClone*)&curr_type->getClone(i);
         if (curr_rate > ran){
             break;
         }
@@ -14,6 +14,10 @@
 #include <fstream>
 #include <vector>
 #include "Clone.h"
+#include "CloneSampler.h"
+#include "SlabPool.h"
+#include "TypeRegistry.h"
+#include "Phylogeny.h"
 #include "main.h"
 
 using namespace std;
@@ -28,29 +32,113 @@ protected:
     CellType *end_node;
     
     double d;
-    double tot_rate;
+    CompensatedSum tot_rate;
+    // total death rate of all cells, kept up to date by CellType. only used with death_var; otherwise the total is d*tot_cell_count.
+    CompensatedSum tot_death;
     double time;
     int max_types;
     int num_types;
     bool death_var;
-    bool recalc_birth;
+    
+    // number of events between exact rebuilds of the rate totals. 0 turns rebuilds off. set with pop_params rate_rebuild.
+    long long rebuild_interval;
+    long long events_since_rebuild;
+    int num_rebuilds;
+    // largest relative difference between a running rate total (including the sampler totals) and its exact rebuild in this run
+    double max_drift;
+    
+    // width of the birth rate bins used to merge clones, 0 for no binning. set with pop_params rate_bins.
+    double rate_bin_width;
+    // bins are taken over log(birth rate) instead of the birth rate
+    bool rate_bins_log;
+    // live clone count that triggers a compaction, and the trigger for the current run (raised when compaction cannot get under the limit)
+    int compact_limit;
+    int next_compaction;
+    
+    // events between passes that free extinct leaf types, 0 for never. set with pop_params prune.
+    long long prune_interval;
+    long long events_since_prune;
+    // types that lost their last cell since the last pass, queued by deactivateType
+    std::vector<CellType *> prune_candidates;
+    // receives one record per freed type while open. see openSpillFile.
+    ofstream spill_file;
     double prev_fit;
     double new_fit;
     int new_type;
     
-    // stores pointers to CellTypes that have been initialized in this simulation run. may include extinct types. no Clones in the simulation should have a CellType not included in this vector.
-    std::vector<CellType *> curr_types;
+    // stores pointers to CellTypes that have been initialized in this simulation run, by type index. may include extinct types. no Clones in the simulation should have a CellType not included here.
+    TypeRegistry curr_types;
+    // parent, children, depth and mutation effect of the types in curr_types, by type index
+    Phylogeny phylogeny;
+    // first of the CellTypes that currently have cells, linked through CellType::getNextActive. the selection walks skip extinct types this way.
+    CellType *active_root;
+    void activateType(CellType& type);
+    void deactivateType(CellType& type);
     // root types are CellTypes present at the start of the simulation. they will be roots of a phylogeny of types. this is distinct from the root clone of the CList- the root clone is just the start of the linked list containing all of the Clones.
     std::vector<CellType *> root_types;
     
     long long tot_cell_count;
     MutationHandler *mut_model;
     
+    // population slots for clones. clone_slots[i] is the clone holding slot i, or NULL if slot i is free.
+    std::vector<Clone *> clone_slots;
+    std::vector<int> free_slots;
+    
+    // NULL when clones are chosen by walking the linked list. set with the pop_params sampler line.
+    CloneSampler *sampler;
+    // true when death rates changed after clones were indexed. the sampler is rebuilt before its next use.
+    bool sampler_stale;
+    // backs every Clone and CellType of this population. emptied in one step by refreshSim.
+    SlabPool clone_pool;
+    void indexClone(Clone& clone);
+    void refreshSampler();
+    
     virtual Clone& chooseReproducer();
-    Clone& chooseDead();
-    Clone& chooseDeadVar(double total_death);
+    virtual Clone& chooseDead();
+    /* the choose methods below take their target instead of drawing it, so one uniform can pick both the kind of event and the clone.
+     @param ran target in [0, total birth rate)
+     */
+    Clone& chooseReproducer(double ran);
+    // @param ran target in [0, tot_cell_count)
+    Clone& chooseDead(double ran);
+    // @param ran target in [0, total death rate)
+    Clone& chooseDeadVar(double ran);
+    void recalcTotalDeath();
+    
+    // called once per event. rebuilds the rate totals every rebuild_interval events.
+    void countEvent();
+    
+    /* recomputes every CellType birth total, tot_rate and tot_death exactly from the clones and records the drift found.
+     also checks the sampler totals against the rebuilt ones and marks the sampler stale if they disagree.
+     */
+    void rebuildRates();
+    
+    /* merges the mergeable clones of each type whose birth rates fall in the same bin into one clone at the bin's centre rate.
+     changes birth rates by at most half a bin width (or the log-width factor), which is the approximation accepted with pop_params rate_bins.
+     */
+    void compactClones();
+    /* @param b birth rate
+     @param bin set to the bin containing b
+     @return representative birth rate of the bin
+     */
+    double binRate(double b, long long& bin);
+    
+    /* frees every queued type that has no cells, clones or children and is not a root type, then any parent left in the same state.
+     records each freed type in the spill file and gives its index back to curr_types.
+     */
+    void pruneTypes();
+    bool canPrune(CellType& type);
+    void pruneType(CellType& type);
+    // writes the type tree columns of type (index, cells, mutation effect, mean birth rate, depth, parent) without ending the line
+    void writeTypeRow(ofstream& outfile, CellType& type);
     void deleteList();
+    // deletes every clone and keeps the (now empty) types
+    void emptyTypes();
     void clearClones();
+    /* removes every type and clone and resets the population state, without releasing the slab pool.
+     keeps the capacity of the type registry, phylogeny and clone slots for the next run.
+     */
+    void resetPopulation();
     virtual bool checkInit();
     virtual double nextEventTime();
     virtual void nextEventExecute();
@@ -59,12 +147,19 @@ protected:
      use insertNode if a new clone should be added.
      @param b TOTAL birth rate of new cells to be added
      @param num_cells number of cells to be added
+     @param death TOTAL death rate of new cells to be added
      */
-    void addCells(int num_cells, double b);
+    void addCells(int num_cells, double b, double death);
     
     /* removes EXACTLY ONE cell from the population
      */
-    void removeCell(double b);
+    void removeCell(double b, double death);
+    
+    /* removes num_cells cells from the population
+     @param b TOTAL birth rate of the cells to be removed
+     @param death TOTAL death rate of the cells to be removed
+     */
+    void removeCells(int num_cells, double b, double death);
     
     void setEnd(CellType& new_end){
         end_node = &new_end;
@@ -76,12 +171,30 @@ protected:
     
     void killCell(Clone& dead);
     
+    // per cell death rate of a clone: its type's rate with death_var, d otherwise
+    double cellDeathRate(Clone& clone);
+    
+    /* performs one birth or death among clones, chosen with probability proportional to its rate.
+     @param total_rate sum of the total birth and death rates of clones
+     */
+    void executeEvent(vector<Clone *>& clones, double total_rate);
+    
     
 public:
     CList();
-    virtual ~CList(){}
+    virtual ~CList();
     CList(double death, MutationHandler& mut_handle, int max);
     
+    /* clone hooks. called by CellType and Clone whenever a clone enters the population, changes its cell count or birth rate, or leaves the population.
+     keep any clone index (such as the sampler) up to date.
+     */
+    virtual void cloneInserted(Clone& clone);
+    virtual void cloneChanged(Clone& clone);
+    virtual void cloneRemoved(Clone& clone);
+    
+    // called when type death rates change after clones were inserted
+    virtual void deathRatesChanged();
+    
     /* adds a new type to the simulation. type must not already be present in the simulation.
      */
     void insertCellType(CellType& new_type);
@@ -112,13 +225,39 @@ public:
         return d;
     }
     
+    int getNumRebuilds(){
+        return num_rebuilds;
+    }
+    
+    double getMaxDrift(){
+        return max_drift;
+    }
+    
+    int getNumClones(){
+        return clone_slots.size() - free_slots.size();
+    }
+    
+    // birth rate mergeable clones are stored at: the centre of b's bin with pop_params rate_bins, b itself otherwise
+    double mergeRate(double b){
+        if (rate_bin_width <= 0){
+            return b;
+        }
+        long long bin;
+        return binRate(b, bin);
+    }
+    
     CellType* getTypeByIndex(int i){
-        return curr_types.at(i);
+        return curr_types.get(i);
+    }
+    
+    // one past the largest type index used in this run. no types exist at or above it.
+    int getTypeIndexEnd(){
+        return curr_types.getIndexEnd();
     }
     
     bool hasCellType(int i){
         try{
-            CellType* test = curr_types.at(i);
+            CellType* test = curr_types.get(i);
             if (!test){
                 return false;
             }
@@ -142,6 +281,7 @@ public:
     
     void addRootType(CellType& new_root){
         root_types.push_back(&new_root);
+        new_root.is_root = true;
     }
     std::vector<CellType *>& getRootTypes(){
         return root_types;
@@ -160,6 +300,12 @@ public:
     
     void walkTypesAndWrite(ofstream& outfile);
     
+    /* starts recording types freed by pruning in filename, one type tree row per type followed by its birth and extinction times.
+     @return false if pruning is off, in which case no file is opened
+     */
+    bool openSpillFile(string filename);
+    void closeSpillFile();
+    
     virtual bool handle_line(vector<string>& parsed_line);
     
     bool read_clones(ifstream& infile);
@@ -177,13 +323,155 @@ public:
 };
 
 class MoranPop: public CList{
+    /* Moran model: every event one uniformly chosen cell dies and a cell chosen by birth rate divides, one event per unit of time.
+     with pop_params embedded_chain 1, events that leave every clone as it was (the dividing cell replaces a dead cell of its own clone without mutating) are skipped in one geometric draw and only their time is counted, so fixation studies pay only for the events that change the population. each event that is not skipped still costs O(n) in the number of clones: the chance that a death changes the population depends on the total birth rate left without the dying cell, so the weights cannot be kept in the CloneSampler through the clone hooks and are recomputed per event. needs a population of clones that canIntegrate() (SimpleClone); others are simulated event by event.
+     */
+private:
+    bool embedded_chain;
+    // clones and their change probabilities for advanceChain, kept between events to avoid reallocating them
+    std::vector<Clone *> chain_clones;
+    std::vector<double> change_probs;
+    /* skips the null events ahead of the next event that changes the population, then executes that event.
+     @return false, with nothing done, if the population can not use the embedded chain or no event can change it
+     */
+    bool advanceChain();
 public:
     MoranPop();
     virtual void advance();
+    bool handle_line(vector<string>& parsed_line);
+};
+
+class MoranSlotPop: public MoranPop{
+    /* Moran model with constant time death selection. every cell has a slot in cells naming its clone, so the uniformly chosen dead cell is one array lookup instead of a walk over the clones.
+     reproducers are chosen through a Fenwick tree CloneSampler (O(log n) in the number of clones) unless pop_params sampler picks another index. sampler linear is rejected.
+     the cell slots follow clone cell counts through the clone hooks.
+     */
+private:
+    // population slot of the clone owning each cell
+    std::vector<int> cells;
+    // positions in cells held by each population slot, and the position of each cell in that list
+    std::vector<std::vector<int> > clone_cells;
+    std::vector<int> cell_rank;
+    void addCellSlots(int slot, long long num);
+    void removeCellSlots(int slot, long long num);
+    // matches the cell slots of clone to its cell count
+    void syncCellSlots(Clone& clone);
+protected:
+    Clone& chooseDead();
+public:
+    MoranSlotPop();
+    // rejects pop_params sampler linear, which would drop the clone index this model is for
+    bool handle_line(vector<string>& parsed_line);
+    void refreshSim();
+    void cloneInserted(Clone& clone);
+    void cloneChanged(Clone& clone);
+    void cloneRemoved(Clone& clone);
+};
+
+class WrightFisherPop: public CList{
+    /* Wright-Fisher model with non-overlapping generations and a constant population size N. one generation is one unit of time.
+     the N offspring are split between the clones by one multinomial draw weighted by clone birth rates, and the mutant offspring of each clone by one binomial draw, so a generation costs O(n) in the number of clones whatever N is.
+     populations with any clone that cannot canIntegrate() (one fixed birth rate and mutation probability per clone) are advanced by Moran steps of 1/N time units instead.
+     */
+private:
+    // one death and one birth, as in MoranPop::advance
+    void moranStep();
+public:
+    WrightFisherPop();
+    void advance();
+};
+
+class NRMPop: public CList{
+    /* branching process simulated with the Gibson-Bruck next reaction method. each clone has a birth reaction (key 2*slot) and a death reaction (key 2*slot+1) with a putative firing time in an indexed heap.
+     only reactions of clones touched by an event are rescheduled, and their random numbers are reused, so an event costs O(log n) in the number of clones.
+     statistically equivalent to the Gillespie loop in CList::advance.
+     */
+private:
+    IndexedHeap event_queue;
+    // propensity each key was last scheduled with
+    std::vector<double> rates;
+    // key of the reaction being executed, -1 otherwise. it gets a fresh draw once the event is done.
+    int firing_key;
+    // true when the queue has to be rebuilt from clone_slots before the next event
+    bool queue_stale;
+    void scheduleReaction(int key, double rate);
+    void scheduleClone(Clone& clone);
+    void rebuildQueue();
+public:
+    NRMPop();
+    void advance();
+    void refreshSim();
+    void cloneInserted(Clone& clone);
+    void cloneChanged(Clone& clone);
+    void cloneRemoved(Clone& clone);
+    void deathRatesChanged();
+};
+
+class TauLeapPop: public CList{
+    /* approximate branching process simulated by tau leaping, with the step size chosen by the Cao-Gillespie-Petzold criterion (no clone's cell count or propensities should change by more than a fraction epsilon per leap).
+     clones that canLeap() and have at least leap_threshold cells are leaped. the remaining critical clones fire at most one exact event per leap.
+     a leap whose Poisson deaths exceed the cells of a clone is rejected and drawn again over half the time, so deaths are never truncated to the cell count.
+     falls back to an exact SSA step whenever the leap would be shorter than a few expected events.
+     */
+private:
+    double epsilon;
+    int leap_threshold;
+    double leapTime(vector<Clone *>& leapers);
+    // draws the leap of every leaper over tau. false if any of them would lose more cells than it holds.
+    bool drawLeaps(vector<Clone *>& leapers, double tau);
+public:
+    TauLeapPop();
+    void advance();
+    bool handle_line(vector<string>& parsed_line);
+};
+
+class HybridPop: public CList{
+    /* branching process where clones that canIntegrate() and have at least threshold cells grow deterministically, n' = (b(1-u) - d) n, while all smaller clones stay fully stochastic.
+     mutants emerge from the deterministic clones as a Poisson process with rate u*b*n(t), sampled exactly by thinning against its maximum over the step.
+     steps are limited so no deterministic clone changes by more than a fraction epsilon.
+     */
+private:
+    double epsilon;
+    long long threshold;
+    // fractional cells of deterministic clones by population slot
+    std::vector<double> frac_cells;
+    double growthRate(Clone& clone);
+    double mutantRate(Clone& clone);
+    void grow(vector<Clone *>& integrated, double dt);
+public:
+    HybridPop();
+    void advance();
+    void refreshSim();
+    void cloneRemoved(Clone& clone);
+    bool handle_line(vector<string>& parsed_line);
+};
+
+class JumpPop: public CList{
+    /* analytic time jumps for populations of clones that canIntegrate() (SimpleClone). between mutations each clone is a linear birth-death process with birth rate b(1-u) and death rate d, so its size after a jump is drawn from the closed-form distribution (binomial survivors plus negative binomial offspring).
+     jumps end at the next mutation or at the next multiple of jump_step, so writers still see every jump_step time units. the engine does not know the writer periods or the stop conditions: writers see the state of the last jump boundary before their sample time unless jump_step divides their period (the default 1 divides every integer period), and listeners are only checked between jumps, so MaxCells can be overshot by one jump and MaxTime by up to jump_step. mutation arrivals are drawn from the birth intensity u*b*n integrated along the expected clone sizes, then assigned to a clone in proportion to its realized intensity; this is exact for the sizes but approximate for mutation timing in small clones, so keep jump_step short relative to 1/b.
+     populations with any other clone type are advanced by exact SSA steps.
+     */
+private:
+    double jump_step;
+    long long drawCloneSize(long long num_cells, double birth, double death, double t);
+    // time until the next mutation, or horizon if there is none before it
+    double nextMutationTime(vector<Clone *>& clones, double horizon);
+public:
+    JumpPop();
+    void advance();
+    bool handle_line(vector<string>& parsed_line);
 };
 
 class PassagePop: public CList{
+    /* branching process thinned to a set number of cells at each passage time. the survivors of a passage are a uniform sample of the cells, drawn clone by clone.
+     */
 private:
+    /* number of marked items in a uniform sample without replacement (hypergeometric), by inversion outward from the mode. takes O(standard deviation) time.
+     @param total number of items
+     @param marked number of marked items
+     @param draws sample size
+     */
+    long long drawHypergeometric(long long total, long long marked, long long draws);
     std::vector<double> frozen_passage_times;
     std::vector<int> frozen_passage_cellnums;
     std::queue<double> passage_times;
@@ -211,10 +499,19 @@ public:
 };
 
 class SexReprPop: public CList{
+    /* sexually reproducing population with non-overlapping generations of constant size. each offspring has a mother from female_types and a father from male_types, both chosen by birth rate.
+     when the MutationHandler has an offspringTable for every pair of parent types, a generation is drawn at once: multinomial mating pair counts per (mother type, father type), multinomial offspring type counts per pair, and one clone per type resized in place. otherwise (or when one offspring type would get different mutation probabilities from different mothers) every offspring is drawn and allocated on its own.
+     */
 private:
     std::vector<int> male_types;
     std::vector<int> female_types;
     bool is_extinct;
+    // draws the next generation from the inheritance table. false, with nothing done, if the MutationHandler has none.
+    bool mateByTable();
+    // makes every type a root again and adds the male and female types that are missing
+    void startGeneration();
+    // sets the type to num cells with birth rate b, held by one clone
+    void setTypeCells(CellType& type, long long num, double b, double mut);
 protected:
     SexReprClone& chooseReproducerVector(vector<int> possible_types);
     SexReprClone& chooseMother();
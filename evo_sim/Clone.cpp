@@ -9,6 +9,7 @@
 #include "Clone.h"
 #include "CList.h"
 #include "main.h"
+#include "SlabPool.h"
 #include <random>
 #include <vector>
 #include <queue>
@@ -16,27 +17,43 @@
 #include <cstdlib>
 #include <sstream>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <pthread.h>
+#include <map>
+#include <typeinfo>
 #include "MutationHandler.h"
 using namespace std;
 
 void Clone::removeOneCell(){
     cell_count--;
     cell_type->subtractOneCell(birth_rate);
+    cell_type->getPopulation().cloneChanged(*this);
 }
 
 Clone::~Clone(){
-    cell_type->subtractOneCell(birth_rate);
-    if (!prev_node){
-        cell_type->setRoot(*next_node);
+    if (type_slot < 0){
+        // never stored (e.g. merged away by CellType::mergeClone), so its cells were never counted by the type or population
+        return;
     }
-    if (!next_node){
-        cell_type->setEnd(*prev_node);
+    cell_type->getPopulation().cloneRemoved(*this);
+    cell_type->subtractOneCell(birth_rate);
+    cell_type->dropClone(*this);
+}
+
+void *Clone::operator new(size_t size){
+    if (slab_pool){
+        return slab_pool->allocate(size);
     }
-    if (prev_node){
-        prev_node->setNext(next_node);
+    return ::operator new(size);
+}
+
+void Clone::operator delete(void *block, size_t size){
+    if (slab_pool){
+        slab_pool->deallocate(block, size);
     }
-    if (next_node){
-        next_node->setPrev(prev_node);
+    else{
+        ::operator delete(block);
     }
 }
 
@@ -48,26 +65,15 @@ FixedStepClone::~FixedStepClone(){
 }
 
 Clone* Clone::getNextClone(){
-    if (!next_node){
-        if (!cell_type->getNext()){
-            return NULL;
-        }
-        else{
-            CellType* next_type = cell_type->getNext();
-            Clone* next_clone = next_type->getRoot();
-            while (next_type && !next_clone){
-                next_type = next_type->getNext();
-                if (next_type){
-                    next_clone = next_type->getRoot();
-                }
-                else{
-                    return NULL;
-                }
-            }
-            return next_clone;
+    if (type_slot >= 0 && type_slot + 1 < cell_type->getNumClones()){
+        return &cell_type->getClone(type_slot + 1);
+    }
+    for (CellType *next_type = cell_type->getNext(); next_type; next_type = next_type->getNext()){
+        if (next_type->getNumClones() > 0){
+            return &next_type->getClone(0);
         }
     }
-    return next_node;
+    return NULL;
 }
 
 double Clone::getDeathRate(){
@@ -83,8 +89,8 @@ Clone::Clone(CellType& type){
     cell_count = 0;
     cell_type = &type;
     mut_prob = 0;
-    next_node = NULL;
-    prev_node = NULL;
+    type_slot = -1;
+    pop_slot = -1;
 }
 
 SimpleClone::SimpleClone(CellType& type) : Clone(type){};
@@ -108,12 +114,10 @@ HeritableClone::HeritableClone(CellType& type, bool mult) : StochClone(type, mul
 
 HerResetClone::HerResetClone(CellType& type, bool mult) : HeritableClone(type, mult){
     num_gen_persist = 0;
-    active_diff = queue<double>();
 }
 
 HerResetExpClone::HerResetExpClone(CellType& type, bool mult) : HerPoissonClone(type, mult){
     time_constant = 0;
-    active_diff = vector<double>();
 }
 
 HerPoissonClone::HerPoissonClone(CellType& type, bool mult) : HeritableClone(type, mult){
@@ -122,7 +126,6 @@ HerPoissonClone::HerPoissonClone(CellType& type, bool mult) : HeritableClone(typ
 
 HerResetEmpiricClone::HerResetEmpiricClone(CellType& type, bool mult) : HerEmpiricClone(type, mult){
     num_gen_persist = 0;
-    active_diff = queue<double>();
 }
 
 TypeEmpiricClone::TypeEmpiricClone(CellType& type, bool mult) : EmpiricalClone(type, mult){
@@ -141,30 +144,97 @@ EmpiricalDimReturnsClone::EmpiricalDimReturnsClone(CellType& type, bool mult) :
 }
 
 void SimpleClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
-        MutationHandler& mut_handle = cell_type->getMutHandler();
-        mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
-        if (mut_handle.getNewType().getEnd() && mut_handle.getNewType().getEnd()->getBirthRate()==mut_handle.getNewBirthRate() && mut_handle.getNewType().getEnd()->getMutProb()== mut_handle.getNewMutProb()){
-            mut_handle.getNewType().getEnd()->addCells(1);
-        }
-        else{
-            SimpleClone *new_node = new SimpleClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), mut_handle.getNewMutProb(), 1);
-            mut_handle.getNewType().insertClone(*new_node);
-        }
-        
+    if (nextDivisionMutates()){
+        reproduceMutant();
     }
     else{
         addCells(1);
     }
 }
 
+void SimpleClone::reproduceMutant(){
+    MutationHandler& mut_handle = cell_type->getMutHandler();
+    mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
+    // recurrent mutations land in the existing clone of their type and rate
+    Clone *existing = mut_handle.getNewType().findIdentical(mut_handle.getNewBirthRate(), mut_handle.getNewMutProb(), typeid(SimpleClone));
+    if (existing){
+        existing->addCells(1);
+    }
+    else{
+        SimpleClone *new_node = new SimpleClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), mut_handle.getNewMutProb(), 1);
+        mut_handle.getNewType().insertClone(*new_node);
+    }
+}
+
+bool SimpleClone::drawLeap(double tau, double death){
+    poisson_distribution<long long> rbirths(getTotalBirth() * tau);
+    poisson_distribution<long long> rdeaths(cell_count * death * tau);
+    leap_births = rbirths(*eng);
+    leap_deaths = rdeaths(*eng);
+    return leap_deaths <= cell_count + leap_births;
+}
+
+void SimpleClone::leap(){
+    long long births = leap_births;
+    long long deaths = leap_deaths;
+    long long muts = countMutations(births);
+    CList& population = cell_type->getPopulation();
+    // once the typespace is full the trial ends, so leftover mutations are added as plain births
+    while (muts > 0 && !population.noTypesLeft()){
+        reproduceMutant();
+        births--;
+        muts--;
+    }
+    if (births > 0){
+        addCells(births);
+    }
+    if (deaths > 0){
+        removeCells(deaths);
+    }
+}
+
+Clone::Clone(const Clone& other){
+    cell_count = 0;
+    cell_type = other.cell_type;
+    birth_rate = other.birth_rate;
+    mut_prob = other.mut_prob;
+    type_slot = -1;
+    pop_slot = -1;
+}
+
+Clone& Clone::splitCell(){
+    Clone *single = copyCell();
+    single->cell_count = 1;
+    removeOneCell();
+    cell_type->insertClone(*single);
+    return *single;
+}
+
+void Clone::reproduceMerged(){
+    Clone& single = splitCell();
+    single.reproduce();
+    // the daughter kept in single goes back into a stored clone with its state, which with rate_bins is usually this one
+    single.getType().rejoinClone(single);
+}
+
+void Clone::setBirthRate(double b){
+    if (type_slot < 0){
+        // not stored yet, so no totals hold the old rate
+        birth_rate = b;
+        return;
+    }
+    cell_type->subtractCells(cell_count, getTotalBirth());
+    birth_rate = b;
+    cell_type->addCells(cell_count, getTotalBirth());
+    cell_type->getPopulation().cloneChanged(*this);
+}
+
 Clone::Clone(CellType& type, double mut){
     cell_count = 0;
     cell_type = &type;
     mut_prob = mut;
-    next_node = NULL;
-    prev_node = NULL;
+    type_slot = -1;
+    pop_slot = -1;
 }
 
 StochClone::StochClone(CellType& type, double mut, bool mult) : Clone(type, mut){
@@ -210,18 +280,18 @@ HeritableClone::HeritableClone(CellType& type, double mu, double sig, double mut
     dist_type = dist;
 }
 
-HerResetClone::HerResetClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, queue<double>& diffs, string dist) : HeritableClone(type, mu, sig, mut, offset, mult, dist){
+HerResetClone::HerResetClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, AlterationRing& diffs, string dist) : HeritableClone(type, mu, sig, mut, offset, mult, dist){
     num_gen_persist = num_gen;
-    active_diff = queue<double>(diffs);
+    active_diff = diffs;
     if (!HerResetClone::checkRep()){
         throw "mismanaged reset queue";
     }
 }
 
-HerResetExpClone::HerResetExpClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, double time, double accum, vector<double>& diffs, string dist) : HerPoissonClone(type, mu, sig, mut, offset, mult, accum, dist){
+HerResetExpClone::HerResetExpClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, double time, double accum, AlterationList& diffs, string dist) : HerPoissonClone(type, mu, sig, mut, offset, mult, accum, dist){
     time_constant = time;
     accum_rate = accum;
-    active_diff = vector<double>(diffs);
+    active_diff = diffs;
     if (!HerResetExpClone::checkRep()){
         throw "bad time constant for HerResetExp";
     }
@@ -231,21 +301,21 @@ HerPoissonClone::HerPoissonClone(CellType& type, double mu, double sig, double m
     accum_rate = accum;
 }
 
-HerResetEmpiricClone::HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, queue<double>& diffs) : HerEmpiricClone(type, mu, sig, mut, offset, mult){
+HerResetEmpiricClone::HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, AlterationRing& diffs) : HerEmpiricClone(type, mu, sig, mut, offset, mult){
     num_gen_persist = num_gen;
-    active_diff = queue<double>(diffs);
+    active_diff = diffs;
     if (!HerResetEmpiricClone::checkRep()){
         throw "mismanaged reset queue";
     }
 }
 
-HerResetClone::HerResetClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, queue<double>& diffs, string dist) : HeritableClone(type, mult){
+HerResetClone::HerResetClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, AlterationRing& diffs, string dist) : HeritableClone(type, mult){
     mean = mu;
     var = sig;
     mut_prob = mut;
     birth_rate = mu;
     num_gen_persist = num_gen;
-    active_diff = queue<double>(diffs);
+    active_diff = diffs;
     dist_type = dist;
     cell_count = 1;
     if (!HerResetClone::checkRep()){
@@ -253,14 +323,14 @@ HerResetClone::HerResetClone(CellType& type, double mu, double sig, double mut,
     }
 }
 
-HerResetExpClone::HerResetExpClone(CellType& type, double mu, double sig, double mut, bool mult, double time, double accum, vector<double>& diffs, string dist) : HerPoissonClone(type, mult){
+HerResetExpClone::HerResetExpClone(CellType& type, double mu, double sig, double mut, bool mult, double time, double accum, AlterationList& diffs, string dist) : HerPoissonClone(type, mult){
     mean = mu;
     var = sig;
     mut_prob = mut;
     birth_rate = mu;
     accum_rate = accum;
     time_constant = time;
-    active_diff = vector<double>(diffs);
+    active_diff = diffs;
     dist_type = dist;
     cell_count = 1;
     if (!HerResetExpClone::checkRep()){
@@ -278,13 +348,13 @@ HerPoissonClone::HerPoissonClone(CellType& type, double mu, double sig, double m
     cell_count = 1;
 }
 
-HerResetEmpiricClone::HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, queue<double>& diffs) : HerEmpiricClone(type, mult){
+HerResetEmpiricClone::HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, AlterationRing& diffs) : HerEmpiricClone(type, mult){
     mean = mu;
     var = sig;
     mut_prob = mut;
     birth_rate = mu;
     num_gen_persist = num_gen;
-    active_diff = queue<double>(diffs);
+    active_diff = diffs;
     cell_count = 1;
     if (!HerResetEmpiricClone::checkRep()){
         throw "mismanaged reset queue";
@@ -331,9 +401,68 @@ TypeEmpiricClone::TypeEmpiricClone(CellType& type, double mu, double sig, double
     cell_count = 1;
 }
 
+void Clone::drawDivisionsToMutation(){
+    long long& divs_to_mut = cell_type->divs_to_mut;
+    cell_type->divs_mut_prob = mut_prob;
+    if (mut_prob <= 0){
+        divs_to_mut = numeric_limits<long long>::max();
+    }
+    else if (mut_prob >= 1){
+        divs_to_mut = 0;
+    }
+    else{
+        geometric_distribution<long long> rgeom(mut_prob);
+        divs_to_mut = rgeom(*eng);
+    }
+}
+
+bool Clone::nextDivisionMutates(){
+    long long& divs_to_mut = cell_type->divs_to_mut;
+    // divisions are independent, so a schedule drawn for another mutation probability can be dropped and drawn again
+    if (divs_to_mut < 0 || cell_type->divs_mut_prob != mut_prob){
+        drawDivisionsToMutation();
+    }
+    if (divs_to_mut == 0){
+        drawDivisionsToMutation();
+        return true;
+    }
+    divs_to_mut--;
+    return false;
+}
+
+long long Clone::countMutations(long long num_divisions){
+    long long& divs_to_mut = cell_type->divs_to_mut;
+    if (divs_to_mut < 0 || cell_type->divs_mut_prob != mut_prob){
+        drawDivisionsToMutation();
+    }
+    long long muts = 0;
+    while (divs_to_mut < num_divisions){
+        num_divisions -= divs_to_mut + 1;
+        muts++;
+        drawDivisionsToMutation();
+    }
+    divs_to_mut -= num_divisions;
+    return muts;
+}
+
+void Clone::removeCells(long long num_cells){
+    if (num_cells >= cell_count){
+        // the destructor removes the last cell
+        num_cells = cell_count - 1;
+        cell_count = 1;
+        cell_type->subtractCells(num_cells, birth_rate * num_cells);
+        delete this;
+        return;
+    }
+    cell_count -= num_cells;
+    cell_type->subtractCells(num_cells, birth_rate * num_cells);
+    cell_type->getPopulation().cloneChanged(*this);
+}
+
 void Clone::addCells(int num_cells){
     cell_count+=num_cells;
     cell_type->addCells(num_cells, birth_rate*num_cells);
+    cell_type->getPopulation().cloneChanged(*this);
 }
 
 double StochClone::drawLogNorm(double mean, double var){
@@ -374,21 +503,25 @@ double StochClone::drawTruncGamma(double mean, double var){
 }
 
 void TypeSpecificClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (cell_count > 1){
+        // clones merged by CList::compactClones divide one cell at a time
+        reproduceMerged();
+        return;
+    }
+    if (nextDivisionMutates()){
         removeOneCell();
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, mean, mut_prob);
         double offset = setNewBirth(mean, var);
         TypeSpecificClone *new_node = new TypeSpecificClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, mut_handle.getNewMutProb(), offset, is_mult);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
         TypeSpecificClone *new_node = new TypeSpecificClone(*cell_type, mean, var, mut_prob, is_mult);
         removeOneCell();
         birth_rate = new_node->getBirthRate();
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
         addCells(1);
     }
 }
@@ -432,34 +565,42 @@ double TypeEmpiricClone::setNewBirth(double mean, double var){
 }
 
 void TypeEmpiricClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (cell_count > 1){
+        // clones merged by CList::compactClones divide one cell at a time
+        reproduceMerged();
+        return;
+    }
+    if (nextDivisionMutates()){
         removeOneCell();
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, mean, mut_prob);
         double offset = setNewBirth(mean, var);
         TypeEmpiricClone *new_node = new TypeEmpiricClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, mut_handle.getNewMutProb(), offset, is_mult);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
         TypeEmpiricClone *new_node = new TypeEmpiricClone(*cell_type, mean, var, mut_prob, is_mult);
         removeOneCell();
         birth_rate = new_node->getBirthRate();
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
         addCells(1);
     }
 }
 
 void HeritableClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (cell_count > 1){
+        // clones merged by CList::compactClones divide one cell at a time
+        reproduceMerged();
+        return;
+    }
+    if (nextDivisionMutates()){
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
         removeOneCell();
         double offset = setNewBirth(birth_rate, var);
         HeritableClone *new_node = new HeritableClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, mut_handle.getNewMutProb(), offset, is_mult, dist_type);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
@@ -467,7 +608,7 @@ void HeritableClone::reproduce(){
         HeritableClone *new_node = new HeritableClone(*cell_type, birth_rate, var, mut_prob, is_mult, dist_type);
         birth_rate = new_node->getBirthRate();
         addCells(1);
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
     }
 }
 
@@ -487,36 +628,13 @@ double HerResetClone::reset(){
 }
 
 void HerResetExpClone::reset(){
-
-    
-    double to_remove;
-    vector<int> index_to_remove = vector<int>();
-    uniform_real_distribution<double> runif;
-    
-    if (is_mult){
-        to_remove = 1;
-        for (int i=0; i<active_diff.size(); i++){
-            if (runif(*eng) < time_constant){
-                to_remove *= active_diff.at(i);
-                index_to_remove.push_back(i);
-            }
-        }
-    }
-    else{
-        to_remove = 0;
-        for (int i=0; i<active_diff.size(); i++){
-            if (runif(*eng) < time_constant){
-                to_remove += active_diff.at(i);
-                index_to_remove.push_back(i);
-            }
-        }
-    }
+    int num_active = active_diff.size();
+    double to_remove = active_diff.removeRandom(time_constant, is_mult);
     
     removeOneCell();
-    if (index_to_remove.size()==0){
+    if (active_diff.size() == num_active){
         return;
     }
-
     
     if (is_mult){
         birth_rate = birth_rate/to_remove;
@@ -524,15 +642,11 @@ void HerResetExpClone::reset(){
     else{
         birth_rate = birth_rate - to_remove;
     }
-    
-    for (int i=index_to_remove.size()-1; i>=0;i--){
-        active_diff.erase(active_diff.begin() + i);
-    }
 }
 
 double HerResetExpClone::add_alteration(){
     double offset = setNewBirth(birth_rate, var);
-    active_diff.push_back(offset);
+    active_diff.push(offset);
     return offset;
 }
 
@@ -576,8 +690,7 @@ double HerResetEmpiricClone::reset(){
 }
 
 void HerResetClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         double offset = reset();
         MutationHandler& mut_handle = cell_type->getMutHandler();
         if (is_mult){
@@ -599,9 +712,8 @@ void HerResetClone::reproduce(){
 }
 
 void HerResetExpClone::reproduce(){
-    uniform_real_distribution<double> runif;
     
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         reset();
         double offset = add_alterations();
         MutationHandler& mut_handle = cell_type->getMutHandler();
@@ -625,8 +737,12 @@ void HerResetExpClone::reproduce(){
 }
 
 void HerPoissonClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (cell_count > 1){
+        // clones merged by CList::compactClones divide one cell at a time
+        reproduceMerged();
+        return;
+    }
+    if (nextDivisionMutates()){
         removeOneCell();
         double offset = add_alterations();
         MutationHandler& mut_handle = cell_type->getMutHandler();
@@ -637,7 +753,7 @@ void HerPoissonClone::reproduce(){
             mut_handle.generateMutant(*cell_type, birth_rate - offset, mut_prob);
         }
         HerPoissonClone *new_node = new HerPoissonClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, mut_handle.getNewMutProb(), offset, is_mult, accum_rate, dist_type);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
@@ -645,13 +761,12 @@ void HerPoissonClone::reproduce(){
         add_alterations();
         HerPoissonClone *new_node = new HerPoissonClone(*cell_type, birth_rate, var, mut_prob, is_mult, accum_rate, dist_type);
         addCells(1);
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
     }
 }
 
 void HerResetEmpiricClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         double offset = reset();
         MutationHandler& mut_handle = cell_type->getMutHandler();
         if (is_mult){
@@ -725,15 +840,18 @@ double HerEmpiricClone::setNewBirth(double mean, double var){
 }
 
 void EmpiricalDimReturnsClone::reproduce(){
+    if (cell_count > 1){
+        reproduceMerged();
+        return;
+    }
     var = orig_var * exp(-dim_rate * cell_type->getPopulation().getCurrTime());
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
         removeOneCell();
         double offset = setNewBirth(birth_rate, var);
         EmpiricalDimReturnsClone *new_node = new EmpiricalDimReturnsClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, orig_var, mut_handle.getNewMutProb(), offset, is_mult);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
@@ -741,19 +859,23 @@ void EmpiricalDimReturnsClone::reproduce(){
         EmpiricalDimReturnsClone *new_node = new EmpiricalDimReturnsClone(*cell_type, birth_rate, var, orig_var, mut_prob, is_mult);
         birth_rate = new_node->getBirthRate();
         addCells(1);
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
     }
 }
 
 void HerEmpiricClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (cell_count > 1){
+        // clones merged by CList::compactClones divide one cell at a time
+        reproduceMerged();
+        return;
+    }
+    if (nextDivisionMutates()){
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
         removeOneCell();
         double offset = setNewBirth(birth_rate, var);
         HerEmpiricClone *new_node = new HerEmpiricClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), var, mut_handle.getNewMutProb(), offset, is_mult);
-        mut_handle.getNewType().insertClone(*new_node);
+        mut_handle.getNewType().mergeClone(*new_node);
         addCells(1);
     }
     else{
@@ -761,7 +883,7 @@ void HerEmpiricClone::reproduce(){
         HerEmpiricClone *new_node = new HerEmpiricClone(*cell_type, birth_rate, var, mut_prob, is_mult);
         birth_rate = new_node->getBirthRate();
         addCells(1);
-        cell_type->insertClone(*new_node);
+        cell_type->mergeClone(*new_node);
     }
 }
 
@@ -873,6 +995,7 @@ bool HerResetClone::readLine(vector<string>& parsed_line){
         cell_type->setDeathRate(death);
     }
     double offset = setNewBirth(mean, var);
+    active_diff.setCapacity(num_gen_persist);
     for (int i=0; i<num_gen_persist-1; i++){
         if (is_mult){
             active_diff.push(1);
@@ -956,6 +1079,7 @@ bool HerResetEmpiricClone::readLine(vector<string>& parsed_line){
         cell_type->setDeathRate(death);
     }
     double offset = setNewBirth(mean, var);
+    active_diff.setCapacity(num_gen_persist);
     for (int i=0; i<num_gen_persist-1; i++){
         active_diff.push(1);
     }
@@ -1014,15 +1138,26 @@ bool EmpiricalDimReturnsClone::readLine(vector<string>& parsed_line){
 }
 
 
-bool EmpiricalClone::readDist(string filename){
-    if (cell_type->hasDist()){
-        return true;
+// distributions read so far, by file name. shared by all simulation threads.
+static map<string, std::shared_ptr<const vector<double> > > loaded_dists;
+static pthread_mutex_t dist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+std::shared_ptr<const vector<double> > EmpiricalClone::loadDist(string filename){
+    pthread_mutex_lock(&dist_lock);
+    map<string, std::shared_ptr<const vector<double> > >::iterator found = loaded_dists.find(filename);
+    if (found != loaded_dists.end()){
+        std::shared_ptr<const vector<double> > dist = found->second;
+        pthread_mutex_unlock(&dist_lock);
+        return dist;
     }
+    pthread_mutex_unlock(&dist_lock);
+    
     ifstream infile;
     infile.open(filename);
     if (!infile.is_open()){
-        return false;
+        return NULL;
     }
+    std::shared_ptr<vector<double> > dist(new vector<double>());
     string line;
     while (getline(infile, line)){
         std::stringstream ss;
@@ -1030,14 +1165,33 @@ bool EmpiricalClone::readDist(string filename){
         ss.str(line);
         try{
             while (getline(ss, tok, '\t')){
-                cell_type->addDistPoint(stod(tok));
+                dist->push_back(stod(tok));
             }
         }
         catch(...){
-            return false;
+            return NULL;
         }
     }
-    return cell_type->hasDist();
+    if (dist->empty()){
+        return NULL;
+    }
+    pthread_mutex_lock(&dist_lock);
+    // another thread may have read the same file meanwhile. keep the first copy so there is only one.
+    std::shared_ptr<const vector<double> > cached = loaded_dists.insert(make_pair(filename, dist)).first->second;
+    pthread_mutex_unlock(&dist_lock);
+    return cached;
+}
+
+bool EmpiricalClone::readDist(string filename){
+    if (cell_type->hasDist()){
+        return true;
+    }
+    std::shared_ptr<const vector<double> > dist = loadDist(filename);
+    if (!dist){
+        return false;
+    }
+    cell_type->setDist(dist);
+    return true;
 }
 
 double EmpiricalClone::drawEmpirical(double mean, double var){
@@ -1096,8 +1250,7 @@ bool Diffusion1DClone::readLine(vector<string>& parsed_line){
 }
 
 void Diffusion1DClone::reproduce(){
-    uniform_real_distribution<double> runif;
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, birth_rate, mut_prob);
         Diffusion1DClone *new_node = new Diffusion1DClone(mut_handle.getNewType(), mut_handle.getNewBirthRate(), mut_handle.getNewMutProb(), drift, diffusion, threshold, curr_pos);
@@ -1205,6 +1358,7 @@ void FixedStepClone::insertCellsOnly(int num_cells, int fitness_class){
 void FixedStepClone::addCells(int num_cells, int fitness_class){
     insertCellsOnly(num_cells, fitness_class);
     cell_type->addCells(num_cells, num_cells*fitness_class * step_size);
+    cell_type->getPopulation().cloneChanged(*this);
 }
 
 void FixedStepClone::removeOneCell(int fitness_class){
@@ -1212,6 +1366,102 @@ void FixedStepClone::removeOneCell(int fitness_class){
     fit_to_num[fitness_class] --;
     cell_count--;
     cell_type->subtractOneCell(fitness_class * step_size);
+    cell_type->getPopulation().cloneChanged(*this);
+}
+
+void FixedStepClone::removeCells(int num_cells, int fitness_class){
+    total_fit -= num_cells * fitness_class * step_size;
+    fit_to_num[fitness_class] -= num_cells;
+    cell_count -= num_cells;
+    cell_type->subtractCells(num_cells, num_cells * fitness_class * step_size);
+    cell_type->getPopulation().cloneChanged(*this);
+}
+
+void FixedStepClone::addMutant(int fitness_class){
+    MutationHandler& mut_handle = cell_type->getMutHandler();
+    mut_handle.generateMutant(*cell_type, fitness_class*step_size, mut_prob);
+    int mut_fit_class = round(mut_handle.getNewBirthRate()/step_size);
+    FixedStepClone *new_node = new FixedStepClone(mut_handle.getNewType(), fwd_prob, back_prob, step_size, mut_handle.getNewMutProb());
+    new_node->insertCellsOnly(1, mut_fit_class);
+    mut_handle.getNewType().insertClone(*new_node);
+}
+
+bool FixedStepClone::drawLeap(double tau, double death){
+    // births and deaths are drawn per fitness class. a dividing cell leaves its class and both daughters land in the class it steps to.
+    leap_births.clear();
+    leap_deaths.clear();
+    for (unordered_map<int, int>::iterator it = fit_to_num.begin(); it != fit_to_num.end(); ++it){
+        if (it->second <= 0){
+            continue;
+        }
+        poisson_distribution<long long> rbirths(it->first * step_size * it->second * tau);
+        poisson_distribution<long long> rdeaths(death * it->second * tau);
+        long long births = rbirths(*eng);
+        long long deaths = rdeaths(*eng);
+        // a cell divides or dies at most once per leap
+        if (births + deaths > it->second){
+            return false;
+        }
+        leap_births.push_back(pair<int, long long>(it->first, births));
+        leap_deaths.push_back(pair<int, long long>(it->first, deaths));
+    }
+    return true;
+}
+
+void FixedStepClone::leap(){
+    unordered_map<int, long long> divisions;
+    vector<pair<int, int> > dying;
+    long long total_dying = 0;
+    for (size_t i=0; i<leap_births.size(); i++){
+        int fitness_class = leap_births[i].first;
+        long long births = leap_births[i].second;
+        long long deaths = leap_deaths[i].second;
+        if (births > 0){
+            binomial_distribution<long long> rfwd(births, fwd_prob);
+            long long fwd = rfwd(*eng);
+            long long back = 0;
+            if (fwd_prob < 1){
+                binomial_distribution<long long> rback(births - fwd, back_prob / (1 - fwd_prob));
+                back = rback(*eng);
+            }
+            divisions[fitness_class + 1] += fwd;
+            divisions[max(0, fitness_class - 1)] += back;
+            divisions[fitness_class] += births - fwd - back;
+            removeCells(births, fitness_class);
+        }
+        if (deaths > 0){
+            dying.push_back(pair<int, int>(fitness_class, deaths));
+            total_dying += deaths;
+        }
+    }
+    CList& population = cell_type->getPopulation();
+    for (unordered_map<int, long long>::iterator it = divisions.begin(); it != divisions.end(); ++it){
+        if (it->second == 0){
+            continue;
+        }
+        long long muts = countMutations(it->second);
+        long long daughters = 2 * it->second;
+        while (muts > 0 && !population.noTypesLeft()){
+            addMutant(it->first);
+            daughters--;
+            muts--;
+        }
+        addCells(daughters, it->first);
+    }
+    bool extinct = (total_dying >= cell_count);
+    for (vector<pair<int, int> >::iterator it = dying.begin(); it != dying.end(); ++it){
+        int deaths = it->second;
+        if (extinct && it + 1 == dying.end()){
+            // the destructor removes the last cell
+            deaths--;
+        }
+        if (deaths > 0){
+            removeCells(deaths, it->first);
+        }
+    }
+    if (extinct){
+        delete this;
+    }
 }
 
 void FixedStepClone::removeOneCell(){
@@ -1232,13 +1482,8 @@ void FixedStepClone::reproduce(){
     }
     removeOneCell(old_fit_class);
     
-    if (runif(*eng) < mut_prob){
-        MutationHandler& mut_handle = cell_type->getMutHandler();
-        mut_handle.generateMutant(*cell_type, new_fit_class*step_size, mut_prob);
-        int mut_fit_class = round(mut_handle.getNewBirthRate()/step_size);
-        FixedStepClone *new_node = new FixedStepClone(mut_handle.getNewType(), fwd_prob, back_prob, step_size, mut_handle.getNewMutProb());
-        new_node->insertCellsOnly(1, mut_fit_class);
-        mut_handle.getNewType().insertClone(*new_node);
+    if (nextDivisionMutates()){
+        addMutant(new_fit_class);
         addCells(1, new_fit_class);
     }
     else{
@@ -1309,7 +1554,7 @@ void FixedDimReturnsClone::reproduce(){
     }
     removeOneCell(old_fit_class);
     
-    if (runif(*eng) < mut_prob){
+    if (nextDivisionMutates()){
         MutationHandler& mut_handle = cell_type->getMutHandler();
         mut_handle.generateMutant(*cell_type, new_fit_class*step_size, mut_prob);
         int mut_fit_class = round(mut_handle.getNewBirthRate()/step_size);
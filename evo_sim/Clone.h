@@ -15,6 +15,8 @@
 #include <string>
 #include <fstream>
 #include <unordered_map>
+#include <memory>
+#include "AlterationHistory.h"
 
 using namespace std;
 
@@ -24,8 +26,12 @@ class MutationHandler;
 
 class Clone{
 private:
-    Clone *next_node;
-    Clone *prev_node;
+    // position of this clone in its CellType's clone arrays. -1 if not stored in a type.
+    int type_slot;
+    // slot of this clone in its population (see CList::cloneInserted). -1 if not in a population.
+    int pop_slot;
+    // draws the divisions left before the next mutant division into the schedule of the CellType
+    void drawDivisionsToMutation();
 protected:
     long long cell_count;
     CellType *cell_type;
@@ -37,8 +43,31 @@ protected:
     virtual bool checkRep(){
         return !(mut_prob < 0 || birth_rate < 0 || cell_count < 0);
     }
+    
+    /* decides whether the next division of this clone produces a mutant. the number of divisions between mutants is geometric with parameter mut_prob, so one draw covers a whole run of non-mutant divisions.
+     the schedule belongs to the CellType and is shared by its clones, so models that make a new clone per division (heritable fitness) still draw once per mutant rather than once per clone.
+     */
+    bool nextDivisionMutates();
+    
+    /* consumes num_divisions divisions of the mutation schedule at once, for leaps and other batched births.
+     @return how many of these divisions produce a mutant
+     */
+    long long countMutations(long long num_divisions);
+    
+    // copies everything but the cells and the population bookkeeping. used by copyCell.
+    Clone(const Clone& other);
+    
+    /* moves one cell of this clone into a new single-cell copy in the same type. used so merged clones divide one cell at a time.
+     should only be called on clones with more than one cell that canMerge().
+     @return the new clone
+     */
+    Clone& splitCell();
+    
+    /* divides one cell of a merged clone. the cell is split off, divides, and each daughter lands in a stored clone of its type with the same state if there is one (this clone when its bin is unchanged), so merged clones stay merged between compactions.
+     */
+    void reproduceMerged();
 public:
-    /* adjusts the linked list so the clone is no longer in the list. adjusts root and end of cell_type as appropriate.
+    /* removes the clone and its last cell from the clone arrays of cell_type. a clone that was never inserted into a type leaves every total alone.
      MODIFIES cell_type
      */
     virtual ~Clone();
@@ -47,6 +76,10 @@ public:
     
     Clone(CellType& type, double mut);
     
+    // clones are allocated from the slab pool of the population simulated by the current thread (see SlabPool)
+    static void *operator new(size_t size);
+    static void operator delete(void *block, size_t size);
+    
     virtual void reproduce() = 0;
     
     virtual void update(double t){}
@@ -80,21 +113,21 @@ public:
     long long getCellCount(){
         return cell_count;
     }
-    void setNext(Clone *child){
-        next_node = child;
-    }
-    void setPrev(Clone *parent){
-        prev_node = parent;
+    int getTypeSlot(){
+        return type_slot;
     }
-    Clone& getNextWithinType(){
-        return *next_node;
-    }
-    Clone& getPrevWithinType(){
-        return *prev_node;
+    void setTypeSlot(int slot){
+        type_slot = slot;
     }
     CellType& getType(){
         return *cell_type;
     }
+    int getPopSlot(){
+        return pop_slot;
+    }
+    void setPopSlot(int slot){
+        pop_slot = slot;
+    }
     
     // only call if previous type is going away
     void setType(CellType& type){
@@ -109,11 +142,58 @@ public:
      */
     virtual void removeOneCell();
     
+    /* removes num_cells cells from this clone. if that empties the clone, the clone is DELETED.
+     MODIFIES clone_list, cell_type
+     */
+    void removeCells(long long num_cells);
+    
     virtual void writeBirthRate(ofstream& outfile){
         for (int i=0; i<cell_count; i++){
             outfile << ", " << getBirthRate();
         }
     }
+    
+    // whether TauLeapPop may advance this clone with leap(). other clones are simulated event by event.
+    virtual bool canLeap(){
+        return false;
+    }
+    
+    /* draws Poisson numbers of births and deaths over one tau leap and keeps them for leap(). nothing is changed yet, so a rejected draw can be drawn again.
+     @param tau length of the leap
+     @param death per cell death rate
+     @return false if more cells would die than the clone can hold, in which case the leap must be drawn again over a shorter tau
+     */
+    virtual bool drawLeap(double tau, double death){
+        return false;
+    }
+    
+    /* applies the births and deaths kept by the last drawLeap, generating one mutant per mutation drawn.
+     the clone is DELETED if all of its cells die.
+     */
+    virtual void leap(){}
+    
+    // whether HybridPop may grow this clone deterministically. requires a fixed per cell birth rate and mutation probability.
+    virtual bool canIntegrate(){
+        return false;
+    }
+    
+    // adds one mutant daughter cell chosen by the MutationHandler, leaving this clone unchanged. only called on clones that canIntegrate().
+    virtual void reproduceMutant(){}
+    
+    // whether this clone may be merged with others of its type: identical ones by CellType::mergeClone, same-bin ones by CList::compactClones. requires that the birth rate is the only per cell state.
+    virtual bool canMerge(){
+        return false;
+    }
+    
+    // unstored copy of this clone with no cells. only called on clones that canMerge().
+    virtual Clone* copyCell(){
+        return NULL;
+    }
+    
+    /* changes the birth rate of every cell in the clone. only the clone changes if it is not stored in a type yet.
+     MODIFIES clone_list, cell_type
+     */
+    void setBirthRate(double b);
 };
 
 class StochClone: public Clone{
@@ -170,7 +250,12 @@ public:
 class EmpiricalClone: public StochClone{
 protected:
     double drawEmpirical(double mean, double var);
+    // gives cell_type the distribution in filename, unless it has one already. each file is read once per process and shared.
     bool readDist(string filename);
+    /* @return the distribution in filename, from the cache if it was read before. NULL if the file cannot be read or parsed.
+     THREAD SAFE
+     */
+    static std::shared_ptr<const vector<double> > loadDist(string filename);
     virtual double setNewBirth(double mean, double var) = 0;
 public:
     virtual void reproduce() = 0;
@@ -180,11 +265,30 @@ public:
 };
 
 class SimpleClone: public Clone{
+private:
+    // births and deaths of the leap drawn by drawLeap
+    long long leap_births;
+    long long leap_deaths;
 public:
     SimpleClone(CellType& type, double b, double mut, int num_cells);
     SimpleClone(CellType& type);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canLeap(){
+        return true;
+    }
+    bool drawLeap(double tau, double death);
+    void leap();
+    bool canIntegrate(){
+        return true;
+    }
+    void reproduceMutant();
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new SimpleClone(*this);
+    }
 };
 
 class TypeSpecificClone: public StochClone{
@@ -200,6 +304,12 @@ public:
     TypeSpecificClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new TypeSpecificClone(*this);
+    }
 };
 
 class HeritableClone: public StochClone{ 
@@ -213,6 +323,12 @@ public:
     HeritableClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new HeritableClone(*this);
+    }
 };
 
 class HerPoissonClone: public HeritableClone{
@@ -229,13 +345,19 @@ public:
     HerPoissonClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new HerPoissonClone(*this);
+    }
 };
 
 class HerResetClone: public HeritableClone{
     // draws one new fitness alteration per generation, removes fitness alterations after exactly a given number of generations
 private:
-    // FIFO queue
-    queue<double> active_diff;
+    // FIFO queue, copied into each daughter
+    AlterationRing active_diff;
     int num_gen_persist;
     
     // called in every reproduction to remove last alteration.
@@ -244,17 +366,22 @@ private:
         return active_diff.size() == num_gen_persist;
     };
 public:
-    HerResetClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, queue<double>& diffs, string dist);
-    HerResetClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, queue<double>& diffs, string dist);
+    HerResetClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, AlterationRing& diffs, string dist);
+    HerResetClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, AlterationRing& diffs, string dist);
     HerResetClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    // the alteration history differs from cell to cell
+    bool canMerge(){
+        return false;
+    }
 };
 
 class HerResetExpClone: public HerPoissonClone{
     // draws one new fitness alteration per generation, removes fitness alterations after an exponentially-distributed number of generations
 private:
-    vector<double> active_diff;
+    // shared with the daughters until one of them removes an alteration
+    AlterationList active_diff;
     
     // Given as exponential rate constant.
     // The average lifetime is 1/time_constant.
@@ -270,11 +397,15 @@ private:
         return (accum_rate > 0 && time_constant > 0);
     };
 public:
-    HerResetExpClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, double time, double accum, vector<double>& diffs, string dist);
-    HerResetExpClone(CellType& type, double mu, double sig, double mut, bool mult, double time, double accum, vector<double>& diffs, string dist);
+    HerResetExpClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, double time, double accum, AlterationList& diffs, string dist);
+    HerResetExpClone(CellType& type, double mu, double sig, double mut, bool mult, double time, double accum, AlterationList& diffs, string dist);
     HerResetExpClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    // the alteration history differs from cell to cell
+    bool canMerge(){
+        return false;
+    }
 };
 
 class TypeEmpiricClone: public EmpiricalClone{
@@ -289,6 +420,12 @@ public:
     TypeEmpiricClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new TypeEmpiricClone(*this);
+    }
 };
 
 class HerEmpiricClone: public EmpiricalClone{
@@ -302,6 +439,12 @@ public:
     HerEmpiricClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new HerEmpiricClone(*this);
+    }
 };
 
 class EmpiricalDimReturnsClone: public HerEmpiricClone{
@@ -315,11 +458,20 @@ public:
     EmpiricalDimReturnsClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    bool canMerge(){
+        return true;
+    }
+    Clone* copyCell(){
+        return new EmpiricalDimReturnsClone(*this);
+    }
 };
 
 class FixedStepClone: public Clone{
 private:
     std::unordered_map<int, int> fit_to_num;
+    // divisions and deaths by fitness class of the leap drawn by drawLeap
+    std::vector<pair<int, long long> > leap_births;
+    std::vector<pair<int, long long> > leap_deaths;
     bool checkRep(){
         return (cell_count >= 0 && total_fit >= 0 && step_size >= 0 && fwd_prob >= 0 && back_prob >= 0 && fwd_prob + back_prob <= 1);
     };
@@ -330,8 +482,12 @@ protected:
     double back_prob;
     void addCells(int num_cells, int fitness);
     void removeOneCell(int fitness_class);
+    // removes num_cells cells of one fitness class. should leave at least one cell in the clone.
+    void removeCells(int num_cells, int fitness_class);
     // Modifies things internal to the FixedStepClone ONLY (not the cell type)
     void insertCellsOnly(int num_cells, int fitness_class);
+    // adds one mutant daughter cell whose fitness class before mutation is fitness_class
+    void addMutant(int fitness_class);
     int chooseReproducer();
     int chooseDead();
 public:
@@ -344,6 +500,11 @@ public:
     double getBirthRate() { return chooseReproducer()*step_size; }
     double getTotalBirth() { return total_fit; }
     virtual void writeBirthRate(ofstream& outfile);
+    virtual bool canLeap(){
+        return true;
+    }
+    bool drawLeap(double tau, double death);
+    void leap();
 };
 
 class FixedDimReturnsClone: public FixedStepClone{
@@ -357,23 +518,31 @@ public:
     bool checkRep(){
         return (dim_rate >= 0);
     };
+    // fitness steps depend on the time of each division
+    bool canLeap(){
+        return false;
+    }
 };
 
 class HerResetEmpiricClone: public HerEmpiricClone{
 private:
-    // FIFO queue
-    queue<double> active_diff;
+    // FIFO queue, copied into each daughter
+    AlterationRing active_diff;
     int num_gen_persist;
     double reset();
     bool checkRep(){
         return active_diff.size() == num_gen_persist;
     };
 public:
-    HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, queue<double>& diffs);
-    HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, queue<double>& diffs);
+    HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, double offset, bool mult, int num_gen, AlterationRing& diffs);
+    HerResetEmpiricClone(CellType& type, double mu, double sig, double mut, bool mult, int num_gen, AlterationRing& diffs);
     HerResetEmpiricClone(CellType& type, bool mult);
     void reproduce();
     bool readLine(vector<string>& parsed_line);
+    // the alteration history differs from cell to cell
+    bool canMerge(){
+        return false;
+    }
 };
 
 class SexReprClone: public Clone{
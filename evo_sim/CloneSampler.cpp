@@ -0,0 +1,469 @@
+//
+//  CloneSampler.cpp
+//  evo_sim
+//
+//  Clone selection and event scheduling structures used by CList in place of the linked list walk.
+//
+
+#include "CloneSampler.h"
+#include "main.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+FenwickIndex::FenwickIndex(){
+    capacity = 0;
+    total = 0;
+}
+
+void FenwickIndex::grow(int min_size){
+    int new_capacity = capacity ? capacity : 64;
+    while (new_capacity < min_size){
+        new_capacity *= 2;
+    }
+    weights.resize(new_capacity, 0);
+    capacity = new_capacity;
+    rebuild();
+}
+
+void FenwickIndex::rebuild(){
+    tree.assign(capacity + 1, 0);
+    nonzero_tree.assign(capacity + 1, 0);
+    total = 0;
+    for (int i=1; i<=capacity; i++){
+        tree[i] += weights[i-1];
+        nonzero_tree[i] += weights[i-1] > 0;
+        total += weights[i-1];
+        int parent = i + (i & -i);
+        if (parent <= capacity){
+            tree[parent] += tree[i];
+            nonzero_tree[parent] += nonzero_tree[i];
+        }
+    }
+}
+
+void FenwickIndex::setWeight(int slot, double weight){
+    if (slot >= capacity){
+        grow(slot + 1);
+    }
+    double delta = weight - weights[slot];
+    if (delta == 0){
+        return;
+    }
+    int count_delta = (weight > 0) - (weights[slot] > 0);
+    weights[slot] = weight;
+    total += delta;
+    for (int i = slot + 1; i <= capacity; i += i & -i){
+        tree[i] += delta;
+        nonzero_tree[i] += count_delta;
+    }
+}
+
+int FenwickIndex::choose(double ran){
+    if (capacity == 0){
+        return -1;
+    }
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= capacity){
+        step *= 2;
+    }
+    for (; step > 0; step /= 2){
+        if (pos + step <= capacity && tree[pos + step] <= ran){
+            pos += step;
+            ran -= tree[pos];
+        }
+    }
+    if (pos < capacity && weights[pos] > 0){
+        return pos;
+    }
+    return nearestNonzero(pos);
+}
+
+int FenwickIndex::countNonzero(int slot){
+    int count = 0;
+    for (int i = slot; i > 0; i -= i & -i){
+        count += nonzero_tree[i];
+    }
+    return count;
+}
+
+int FenwickIndex::findNonzero(int k){
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= capacity){
+        step *= 2;
+    }
+    for (; step > 0; step /= 2){
+        if (pos + step <= capacity && nonzero_tree[pos + step] < k){
+            pos += step;
+            k -= nonzero_tree[pos];
+        }
+    }
+    return pos;
+}
+
+int FenwickIndex::nearestNonzero(int slot){
+    int below = countNonzero(min(slot + 1, capacity));
+    if (below > 0){
+        return findNonzero(below);
+    }
+    if (countNonzero(capacity) > 0){
+        return findNonzero(1);
+    }
+    return -1;
+}
+
+void FenwickIndex::clear(){
+    weights.assign(capacity, 0);
+    tree.assign(capacity + 1, 0);
+    nonzero_tree.assign(capacity + 1, 0);
+    total = 0;
+}
+
+CompositionIndex::CompositionIndex(){
+    Group empty;
+    empty.sum = 0;
+    empty.active_pos = -1;
+    groups.assign(2 * EXP_OFFSET, empty);
+}
+
+int CompositionIndex::groupOf(double weight){
+    int exponent;
+    frexp(weight, &exponent);
+    return exponent + EXP_OFFSET;
+}
+
+void CompositionIndex::insertSlot(int slot, int group){
+    Group& g = groups[group];
+    if (g.members.empty()){
+        g.active_pos = active_groups.size();
+        active_groups.push_back(group);
+    }
+    slot_group[slot] = group;
+    slot_pos[slot] = g.members.size();
+    g.members.push_back(slot);
+    g.sum += weights[slot];
+}
+
+void CompositionIndex::eraseSlot(int slot){
+    Group& g = groups[slot_group[slot]];
+    int last = g.members.back();
+    g.members[slot_pos[slot]] = last;
+    slot_pos[last] = slot_pos[slot];
+    g.members.pop_back();
+    g.sum -= weights[slot];
+    if (g.members.empty()){
+        // exact reset so rounding error does not outlive the group's members
+        g.sum = 0;
+        int moved = active_groups.back();
+        active_groups[g.active_pos] = moved;
+        groups[moved].active_pos = g.active_pos;
+        active_groups.pop_back();
+        g.active_pos = -1;
+    }
+    slot_group[slot] = -1;
+}
+
+void CompositionIndex::setWeight(int slot, double weight){
+    if (slot >= (int)weights.size()){
+        weights.resize(slot + 1, 0);
+        slot_group.resize(slot + 1, -1);
+        slot_pos.resize(slot + 1, -1);
+    }
+    if (weight == weights[slot]){
+        return;
+    }
+    int new_group = -1;
+    if (weight > 0){
+        new_group = groupOf(weight);
+    }
+    if (new_group >= 0 && new_group == slot_group[slot]){
+        groups[new_group].sum += weight - weights[slot];
+        weights[slot] = weight;
+        return;
+    }
+    if (slot_group[slot] >= 0){
+        eraseSlot(slot);
+    }
+    weights[slot] = weight;
+    if (new_group >= 0){
+        insertSlot(slot, new_group);
+    }
+}
+
+int CompositionIndex::choose(double ran){
+    if (active_groups.empty()){
+        return -1;
+    }
+    int group = active_groups.back();
+    for (vector<int>::iterator it = active_groups.begin(); it != active_groups.end(); ++it){
+        if (ran < groups[*it].sum){
+            group = *it;
+            break;
+        }
+        ran -= groups[*it].sum;
+    }
+    Group& g = groups[group];
+    double bound = ldexp(1.0, group - EXP_OFFSET);
+    int size = g.members.size();
+    // the first trial reuses the leftover of ran, which is uniform within the chosen group
+    double u = 0;
+    if (g.sum > 0 && ran > 0){
+        u = min(ran / g.sum, 1.0) * size;
+    }
+    uniform_real_distribution<double> runif;
+    while (true){
+        int pos = min((int)u, size - 1);
+        int slot = g.members[pos];
+        if ((u - pos) * bound < weights[slot]){
+            return slot;
+        }
+        u = runif(*eng) * size;
+    }
+}
+
+double CompositionIndex::getTotal(){
+    double total = 0;
+    for (vector<int>::iterator it = active_groups.begin(); it != active_groups.end(); ++it){
+        total += groups[*it].sum;
+    }
+    return total;
+}
+
+void CompositionIndex::clear(){
+    for (vector<int>::iterator it = active_groups.begin(); it != active_groups.end(); ++it){
+        groups[*it].members.clear();
+        groups[*it].sum = 0;
+        groups[*it].active_pos = -1;
+    }
+    active_groups.clear();
+    weights.assign(weights.size(), 0);
+    slot_group.assign(slot_group.size(), -1);
+    slot_pos.assign(slot_pos.size(), -1);
+}
+
+ScanIndex::ScanIndex(){
+    total = 0;
+}
+
+double ScanIndex::blockSum(const double *block){
+#if defined(__AVX__)
+    __m256d sum = _mm256_add_pd(_mm256_loadu_pd(block), _mm256_loadu_pd(block + 4));
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum), _mm256_extractf128_pd(sum, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+#elif defined(__SSE2__)
+    __m128d sum = _mm_add_pd(_mm_add_pd(_mm_loadu_pd(block), _mm_loadu_pd(block + 2)), _mm_add_pd(_mm_loadu_pd(block + 4), _mm_loadu_pd(block + 6)));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+#else
+    double sum = 0;
+    for (int i=0; i<BLOCK; i++){
+        sum += block[i];
+    }
+    return sum;
+#endif
+}
+
+void ScanIndex::setWeight(int slot, double weight){
+    if (slot >= (int)weights.size()){
+        weights.resize((slot / BLOCK + 1) * BLOCK, 0);
+    }
+    total += weight - weights[slot];
+    weights[slot] = weight;
+}
+
+int ScanIndex::choose(double ran){
+    int size = weights.size();
+    const double *data = weights.data();
+    for (int start = 0; start < size; start += BLOCK){
+        double block_total = blockSum(data + start);
+        if (ran < block_total){
+            for (int i = start; i < start + BLOCK; i++){
+                if (ran < weights[i]){
+                    return i;
+                }
+                ran -= weights[i];
+            }
+            // block sum and scalar sum rounded differently
+            return lastNonzero(start + BLOCK);
+        }
+        ran -= block_total;
+    }
+    return lastNonzero(size);
+}
+
+int ScanIndex::lastNonzero(int end){
+    for (int i = end - 1; i >= 0; i--){
+        if (weights[i] > 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void ScanIndex::clear(){
+    weights.assign(weights.size(), 0);
+    total = 0;
+}
+
+AdaptiveIndex::AdaptiveIndex(){
+    num_nonzero = 0;
+    active = &scan;
+}
+
+void AdaptiveIndex::switchTo(WeightIndex& next){
+    next.clear();
+    for (int i=0; i<(int)weights.size(); i++){
+        if (weights[i] > 0){
+            next.setWeight(i, weights[i]);
+        }
+    }
+    active = &next;
+}
+
+void AdaptiveIndex::setWeight(int slot, double weight){
+    if (slot >= (int)weights.size()){
+        weights.resize(slot + 1, 0);
+    }
+    if (weights[slot] > 0){
+        num_nonzero--;
+    }
+    if (weight > 0){
+        num_nonzero++;
+    }
+    weights[slot] = weight;
+    active->setWeight(slot, weight);
+    if (active == &scan && num_nonzero > TO_TREE){
+        switchTo(tree);
+    }
+    else if (active == &tree && num_nonzero < TO_SCAN){
+        switchTo(scan);
+    }
+}
+
+void AdaptiveIndex::clear(){
+    weights.assign(weights.size(), 0);
+    num_nonzero = 0;
+    scan.clear();
+    tree.clear();
+    active = &scan;
+}
+
+CloneSampler::CloneSampler(WeightIndex& birth, WeightIndex& count, WeightIndex& death){
+    birth_index = &birth;
+    count_index = &count;
+    death_index = &death;
+}
+
+CloneSampler::~CloneSampler(){
+    delete birth_index;
+    delete count_index;
+    delete death_index;
+}
+
+void CloneSampler::setClone(int slot, double birth, double count, double death){
+    birth_index->setWeight(slot, birth);
+    count_index->setWeight(slot, count);
+    death_index->setWeight(slot, death);
+}
+
+void CloneSampler::removeClone(int slot){
+    setClone(slot, 0, 0, 0);
+}
+
+void CloneSampler::clear(){
+    birth_index->clear();
+    count_index->clear();
+    death_index->clear();
+}
+
+void IndexedHeap::swapNodes(int i, int j){
+    int key_i = heap[i];
+    heap[i] = heap[j];
+    heap[j] = key_i;
+    pos[heap[i]] = i;
+    pos[heap[j]] = j;
+}
+
+void IndexedHeap::siftUp(int i){
+    while (i > 0){
+        int parent = (i - 1) / 2;
+        if (times[heap[parent]] <= times[heap[i]]){
+            return;
+        }
+        swapNodes(i, parent);
+        i = parent;
+    }
+}
+
+void IndexedHeap::siftDown(int i){
+    int size = heap.size();
+    while (true){
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < size && times[heap[left]] < times[heap[smallest]]){
+            smallest = left;
+        }
+        if (right < size && times[heap[right]] < times[heap[smallest]]){
+            smallest = right;
+        }
+        if (smallest == i){
+            return;
+        }
+        swapNodes(i, smallest);
+        i = smallest;
+    }
+}
+
+void IndexedHeap::update(int key, double time){
+    if (key >= (int)pos.size()){
+        pos.resize(key + 1, -1);
+        times.resize(key + 1, 0);
+    }
+    if (pos[key] < 0){
+        times[key] = time;
+        pos[key] = heap.size();
+        heap.push_back(key);
+        siftUp(pos[key]);
+        return;
+    }
+    double old_time = times[key];
+    times[key] = time;
+    if (time < old_time){
+        siftUp(pos[key]);
+    }
+    else{
+        siftDown(pos[key]);
+    }
+}
+
+void IndexedHeap::remove(int key){
+    if (!contains(key)){
+        return;
+    }
+    int i = pos[key];
+    int last = heap.size() - 1;
+    if (i != last){
+        swapNodes(i, last);
+    }
+    heap.pop_back();
+    pos[key] = -1;
+    if (i < (int)heap.size()){
+        int moved = heap[i];
+        siftUp(i);
+        siftDown(pos[moved]);
+    }
+}
+
+void IndexedHeap::clear(){
+    heap.clear();
+    pos.assign(pos.size(), -1);
+}
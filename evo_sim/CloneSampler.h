@@ -0,0 +1,226 @@
+//
+//  CloneSampler.h
+//  evo_sim
+//
+//  Clone selection and event scheduling structures used by CList in place of the linked list walk.
+//
+
+#ifndef CloneSampler_h
+#define CloneSampler_h
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+class WeightIndex{
+    /* stores one non-negative weight per clone slot and chooses slots with probability proportional to their weight.
+     slots are the population-wide clone ids handed out by CList::cloneInserted.
+     ABSTRACT CLASS
+     */
+public:
+    virtual ~WeightIndex(){}
+
+    // sets the weight of a slot. slots that were never set have weight 0.
+    virtual void setWeight(int slot, double weight) = 0;
+
+    /* @param ran target weight, uniform in [0, getTotal())
+     @return slot whose cumulative weight interval contains ran, or -1 if every weight is 0.
+     */
+    virtual int choose(double ran) = 0;
+
+    virtual double getTotal() = 0;
+
+    // sets all weights to 0. keeps allocated capacity.
+    virtual void clear() = 0;
+};
+
+class FenwickIndex: public WeightIndex{
+    /* binary indexed tree over the slot weights. O(log n) weight updates and selection.
+     */
+private:
+    // leaf weights by slot
+    vector<double> weights;
+    // 1-based Fenwick tree. tree[i] holds the sum of weights (i - lowbit(i), i].
+    vector<double> tree;
+    // the same tree over the number of slots with positive weight. integer counts, so it has no rounding error.
+    vector<int> nonzero_tree;
+    int capacity;
+    double total;
+    void grow(int min_size);
+    void rebuild();
+    // number of slots below slot with positive weight
+    int countNonzero(int slot);
+    // the k-th slot (from 1) with positive weight
+    int findNonzero(int k);
+    // recovers from rounding error in the tree sums by moving to the closest slot with positive weight at or below slot, else above it. O(log n).
+    int nearestNonzero(int slot);
+public:
+    FenwickIndex();
+    void setWeight(int slot, double weight);
+    int choose(double ran);
+    double getTotal(){
+        return total;
+    }
+    void clear();
+};
+
+class CompositionIndex: public WeightIndex{
+    /* composition-rejection sampler. group e holds the slots with weight in [2^(e-1), 2^e).
+     a group is picked by its summed weight, then a slot inside it by rejection against 2^e, which accepts with probability at least 1/2.
+     updates are O(1) and selection costs O(number of occupied groups), independent of the number of slots.
+     */
+private:
+    struct Group{
+        vector<int> members;
+        double sum;
+        // position in active_groups, -1 if the group is empty
+        int active_pos;
+    };
+    vector<double> weights;
+    // group index of each slot, -1 for slots with weight 0
+    vector<int> slot_group;
+    // position of each slot in its group's member list
+    vector<int> slot_pos;
+    // indexed by frexp exponent + EXP_OFFSET
+    vector<Group> groups;
+    vector<int> active_groups;
+    static const int EXP_OFFSET = 1075;
+    int groupOf(double weight);
+    void insertSlot(int slot, int group);
+    void eraseSlot(int slot);
+public:
+    CompositionIndex();
+    void setWeight(int slot, double weight);
+    int choose(double ran);
+    // sums the occupied groups so that the total matches the walk in choose exactly
+    double getTotal();
+    void clear();
+};
+
+class ScanIndex: public WeightIndex{
+    /* flat weight array searched with a linear prefix sum. partial sums are taken over blocks of BLOCK weights using AVX or SSE2 when the compiler targets them (make ARCH=-mavx2), with a scalar loop otherwise.
+     no pointer chasing, so it beats the tree indexes up to a few thousand slots.
+     */
+private:
+    // padded with zeros to a multiple of BLOCK
+    vector<double> weights;
+    double total;
+    static const int BLOCK = 8;
+    double blockSum(const double *block);
+    // recovers from rounding error in the running sum
+    int lastNonzero(int end);
+public:
+    ScanIndex();
+    void setWeight(int slot, double weight);
+    int choose(double ran);
+    double getTotal(){
+        return total;
+    }
+    void clear();
+};
+
+class AdaptiveIndex: public WeightIndex{
+    /* uses a ScanIndex while few slots have positive weight and a FenwickIndex once there are many.
+     the switch rebuilds the new index from scratch; the thresholds are apart so a population near the boundary does not flip back and forth.
+     */
+private:
+    vector<double> weights;
+    int num_nonzero;
+    WeightIndex *active;
+    ScanIndex scan;
+    FenwickIndex tree;
+    static const int TO_TREE = 4096;
+    static const int TO_SCAN = 2048;
+    void switchTo(WeightIndex& next);
+public:
+    AdaptiveIndex();
+    void setWeight(int slot, double weight);
+    int choose(double ran){
+        return active->choose(ran);
+    }
+    double getTotal(){
+        return active->getTotal();
+    }
+    void clear();
+};
+
+class CloneSampler{
+    /* picks clones of a population by total birth rate (reproduction), by cell count (uniform death), and by total death rate (type-specific death).
+     CList keeps the weights current through its clone hooks. owns its WeightIndexes.
+     */
+private:
+    WeightIndex *birth_index;
+    WeightIndex *count_index;
+    WeightIndex *death_index;
+public:
+    CloneSampler(WeightIndex& birth, WeightIndex& count, WeightIndex& death);
+    ~CloneSampler();
+
+    /* @param slot population slot of the clone
+     @param birth TOTAL birth rate of the clone
+     @param count number of cells in the clone
+     @param death TOTAL death rate of the clone. only used for type-specific death rates.
+     */
+    void setClone(int slot, double birth, double count, double death);
+    void removeClone(int slot);
+
+    // all choose methods take a target uniform in [0, matching total) and return a slot, or -1 if there is nothing to choose
+    int chooseReproducer(double ran){
+        return birth_index->choose(ran);
+    }
+    int chooseByCount(double ran){
+        return count_index->choose(ran);
+    }
+    int chooseByDeath(double ran){
+        return death_index->choose(ran);
+    }
+    double getTotalBirth(){
+        return birth_index->getTotal();
+    }
+    double getTotalCount(){
+        return count_index->getTotal();
+    }
+    double getTotalDeath(){
+        return death_index->getTotal();
+    }
+    void clear();
+};
+
+class IndexedHeap{
+    /* binary min-heap of event times keyed by small non-negative integer ids, with a position map so any key can be moved or removed in O(log n).
+     used by NRMPop as the Gibson-Bruck indexed priority queue.
+     */
+private:
+    // heap of keys ordered by times[key]
+    vector<int> heap;
+    // heap position of each key, -1 if the key is not scheduled
+    vector<int> pos;
+    vector<double> times;
+    void swapNodes(int i, int j);
+    void siftUp(int i);
+    void siftDown(int i);
+public:
+    // schedules key at time, or moves it if it is already scheduled
+    void update(int key, double time);
+    void remove(int key);
+    bool contains(int key){
+        return key < (int)pos.size() && pos[key] >= 0;
+    }
+    double getTime(int key){
+        return times[key];
+    }
+    int top(){
+        return heap.front();
+    }
+    double topTime(){
+        return times[heap.front()];
+    }
+    bool empty(){
+        return heap.empty();
+    }
+    void clear();
+};
+
+#endif /* CloneSampler_h */
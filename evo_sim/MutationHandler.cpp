@@ -54,7 +54,6 @@ CellType* MutationHandler::getNewTypeByIndex(int index, CellType& curr_type){
     else{
         CellType *new_type = new CellType(index, &curr_type);
         clone_list->insertCellType(*new_type);
-        curr_type.addChild(*new_type);
         return new_type;
     }
 }
@@ -776,6 +775,42 @@ void FathersCurseMutation::generateMutant(CellType& mother_type, CellType& fathe
     mut_prob = mut;
 }
 
+bool FathersCurseMutation::offspringTable(int mother_type, int father_type, double mut, vector<double>& probs, vector<double>& births, vector<double>& muts){
+    if (mother_type < 0 || mother_type > 2 || father_type < 3 || father_type > 8){
+        return false;
+    }
+    // chance of passing on an a allele, by parent autosome genotype AA, Aa, aa
+    double a_allele[3] = {0, 0.5, 1};
+    double mother_a = a_allele[mother_type];
+    double father_a = a_allele[(father_type - 3) % 3];
+    double genotype[3];
+    genotype[0] = (1 - mother_a) * (1 - father_a);
+    genotype[2] = mother_a * father_a;
+    genotype[1] = 1 - genotype[0] - genotype[2];
+    // autosome mutation moves AA and aa to Aa, and Aa to AA or aa with equal chance
+    double mutated[3];
+    mutated[0] = genotype[0] * (1 - autosome_mut) + genotype[1] * autosome_mut / 2;
+    mutated[1] = genotype[1] * (1 - autosome_mut) + (genotype[0] + genotype[2]) * autosome_mut;
+    mutated[2] = genotype[2] * (1 - autosome_mut) + genotype[1] * autosome_mut / 2;
+    // a y mutation flips the father's Y
+    double y_prob = father_type > 5 ? 1 - y_mut : y_mut;
+    double fitness[3] = {f_AA, f_Aa, f_aa};
+    double fitness_y[3] = {f_AA_y, f_Aa_y, f_aa_y};
+    probs.assign(9, 0);
+    births.assign(9, 0);
+    // offspring keep the mutation probability of their mother, as in generateMutant
+    muts.assign(9, mut);
+    for (int i=0; i<3; i++){
+        probs[i] = mutated[i] * (1 - male_prob);
+        probs[3 + i] = mutated[i] * male_prob * (1 - y_prob);
+        probs[6 + i] = mutated[i] * male_prob * y_prob;
+        births[i] = fitness[i];
+        births[3 + i] = fitness[i];
+        births[6 + i] = fitness_y[i];
+    }
+    return true;
+}
+
 bool FathersCurseMutation::read(std::vector<string>& params){
     /*
      Format for FathersCurse params line:
@@ -68,6 +68,17 @@ public:
     void generateMutant(CellType& type, double b, double mut){};
     virtual void generateMutant(CellType& mother_type, CellType& father_type, double b, double mut)=0;
     virtual bool read(std::vector<string>& params) = 0;
+    
+    /* inheritance table of one mating, used by SexReprPop to draw a whole generation at once.
+     @param mut mutation probability of the mother, as passed to generateMutant
+     @param probs set to the probability of an offspring of each type index
+     @param births set to the birth rate of an offspring of each type index
+     @param muts set to the mutation probability of an offspring of each type index
+     @return false if offspring of these parent types can only be drawn one at a time with generateMutant
+     */
+    virtual bool offspringTable(int mother_type, int father_type, double mut, vector<double>& probs, vector<double>& births, vector<double>& muts){
+        return false;
+    }
 };
 
 class FathersCurseMutation: public SexReprMutation{
@@ -86,6 +97,8 @@ public:
     FathersCurseMutation();
     void generateMutant(CellType& mother_type, CellType& father_type, double b, double mut);
     bool read(std::vector<string>& params);
+    // the distribution drawn from by generateMutant, for mother types 0-2 and father types 3-8
+    bool offspringTable(int mother_type, int father_type, double mut, vector<double>& probs, vector<double>& births, vector<double>& muts);
 };
 
 class ThreeTypesMutation: public MutationHandler {
@@ -62,11 +62,14 @@ bool DuringOutputWriter::shouldWrite(CList& clone_list){
 
 TypeStructureWriter::TypeStructureWriter(string ofile):OutputWriter(ofile), FinalOutputWriter(ofile){
     ofile_name = "_type_tree.oevo";
+    has_spill = false;
 }
 
 void TypeStructureWriter::beginAction(CList &clone_list){
     string ofile_middle = "sim_"+to_string(sim_number);
     outfile.open(ofile_loc + ofile_middle + ofile_name, ios::app);
+    spill_name = ofile_loc + ofile_middle + "_type_spill.oevo";
+    has_spill = clone_list.openSpillFile(spill_name);
 }
 
 TypeStructureWriter::~TypeStructureWriter(){
@@ -75,6 +78,18 @@ TypeStructureWriter::~TypeStructureWriter(){
 }
 
 void TypeStructureWriter::finalAction(CList& clone_list){
+    if (has_spill){
+        // freed types first: the parent of a freed type is the next row with that index
+        clone_list.closeSpillFile();
+        ifstream spill(spill_name);
+        string line;
+        while (getline(spill, line)){
+            outfile << line << endl;
+        }
+        spill.close();
+        remove(spill_name.c_str());
+        has_spill = false;
+    }
     clone_list.walkTypesAndWrite(outfile);
     /*
     std::vector<CellType *> roots = clone_list.getRootTypes();
@@ -227,7 +242,7 @@ CellCountWriter::~CellCountWriter(){
 
 void CountStepWriter::duringSimAction(CList& clone_list){
     timestep ++;
-    if (shouldWrite(clone_list) && clone_list.getTypeByIndex(index)->getNumCells() > 0){
+    if (shouldWrite(clone_list) && clone_list.getTypeByIndex(index) && clone_list.getTypeByIndex(index)->getNumCells() > 0){
         outfile << timestep << ", " << clone_list.getTypeByIndex(index)->getNumCells() << endl;
     }
 }
@@ -366,6 +381,22 @@ EndTimeWriter::~EndTimeWriter(){
     outfile.close();
 }
 
+RateDriftWriter::RateDriftWriter(string ofile): OutputWriter(ofile), FinalOutputWriter(ofile){
+    ofile_name = "rate_drift.oevo";
+    outfile.open(ofile_loc+ofile_name, ios::app);
+}
+
+void RateDriftWriter::finalAction(CList& clone_list){
+    outfile << sim_number << ", " << clone_list.getNumRebuilds() << ", " << clone_list.getMaxDrift() << endl;
+    outfile.flush();
+    sim_number++;
+}
+
+RateDriftWriter::~RateDriftWriter(){
+    outfile.flush();
+    outfile.close();
+}
+
 MotherDaughterWriter::~MotherDaughterWriter(){
     outfile.flush();
     outfile.close();
@@ -389,7 +420,7 @@ void EndPopWriter::finalAction(CList& clone_list){
 
 void EndPopTypesWriter::finalAction(CList& clone_list){
     outfile << sim_number << endl;
-    for (int i=0; i<clone_list.getMaxTypes(); i++){
+    for (int i=0; i<clone_list.getTypeIndexEnd(); i++){
         if (clone_list.hasCellType(i)){
              outfile << i << ", " << clone_list.getTypeByIndex(i)->getNumCells() << endl;
         }
@@ -554,10 +585,9 @@ AllTypesWideWriter::~AllTypesWideWriter(){
 }
 
 void FitnessDistWriter::write_dist(ofstream& outfile, CList& clone_list){
-    Clone *curr_clone = (clone_list.getTypeByIndex(index)->getRoot());
-    while (curr_clone){
-        curr_clone->writeBirthRate(outfile);
-        curr_clone = &(curr_clone->getNextWithinType());
+    CellType *curr_type = clone_list.getTypeByIndex(index);
+    for (int i=0; i<curr_type->getNumClones(); i++){
+        curr_type->getClone(i).writeBirthRate(outfile);
     }
 }
 
@@ -138,6 +138,9 @@ public:
 class TypeStructureWriter: public FinalOutputWriter{
 private:
     ofstream outfile;
+    // types freed by pruning during the run, copied into outfile ahead of the live types
+    string spill_name;
+    bool has_spill;
 public:
     TypeStructureWriter(string ofile);
     ~TypeStructureWriter();
@@ -260,6 +263,18 @@ public:
     bool readLine(vector<string>& parsed_line){return true;}
 };
 
+class RateDriftWriter: public FinalOutputWriter{
+    // writes how many exact rate rebuilds happened in each run and the largest relative drift they corrected
+private:
+    ofstream outfile;
+public:
+    ~RateDriftWriter();
+    RateDriftWriter(string ofile);
+    void finalAction(CList& clone_list);
+    void beginAction(CList& clone_list){};
+    bool readLine(vector<string>& parsed_line){return true;}
+};
+
 class EndPopWriter: public FinalOutputWriter{
 private:
     ofstream outfile;
@@ -309,7 +324,9 @@ template <class WRITER_CLASS> void AllTypesWriter<WRITER_CLASS>::addWriter(CList
 template <class WRITER_CLASS> AllTypesWriter<WRITER_CLASS>:: AllTypesWriter(string ofile): OutputWriter(ofile){}
 
 template <class WRITER_CLASS> AllTypesWriter<WRITER_CLASS>:: ~AllTypesWriter(){
-    vector<WRITER_CLASS *>().swap(writers);
+    for (typename vector<WRITER_CLASS *>::iterator it = writers.begin(); it != writers.end(); ++it){
+        delete *it;
+    }
 }
 
 template <class WRITER_CLASS> void AllTypesWriter<WRITER_CLASS>::beginAction(CList& clone_list){
@@ -332,7 +349,7 @@ template <class WRITER_CLASS> void AllTypesWriter<WRITER_CLASS>::duringSimAction
     }
     
     vector<int> new_types = vector<int>();
-    for (int i=0; i<clone_list.getMaxTypes(); i++){
+    for (int i=0; i<clone_list.getTypeIndexEnd(); i++){
         if (!clone_list.getTypeByIndex(i)){
             continue;
         }
@@ -353,8 +370,10 @@ template <class WRITER_CLASS> void AllTypesWriter<WRITER_CLASS>::duringSimAction
 template <class WRITER_CLASS> void AllTypesWriter<WRITER_CLASS>::finalAction(CList& clone_list){
     for (typename vector<WRITER_CLASS *>::iterator it = writers.begin(); it != writers.end(); ++it){
         (*it)->finalAction(clone_list);
+        delete *it;
     }
-    vector<WRITER_CLASS *>().swap(writers);
+    // keeps the capacity for the next run
+    writers.clear();
 }
 
 template <class WRITER_CLASS> bool AllTypesWriter<WRITER_CLASS>::readLine(vector<string>& parsed_line){
@@ -0,0 +1,82 @@
+//
+//  Phylogeny.cpp
+//  evo_sim
+//
+//  Parent/child edges, depth and mutation effect of the CellTypes of a population, in arrays by type index.
+//
+
+#include "Phylogeny.h"
+#include <vector>
+
+using namespace std;
+
+const int Phylogeny::NONE;
+
+void Phylogeny::addNode(int i, int parent){
+    if (i >= (int)parents.size()){
+        parents.resize(i + 1, NONE);
+        first_child.resize(i + 1, NONE);
+        next_sibling.resize(i + 1, NONE);
+        prev_sibling.resize(i + 1, NONE);
+        depths.resize(i + 1, 0);
+        mut_effects.resize(i + 1, 0);
+    }
+    first_child[i] = NONE;
+    depths[i] = parent == NONE ? 0 : depths[parent] + 1;
+    mut_effects[i] = 0;
+    link(i, parent);
+}
+
+void Phylogeny::removeNode(int i){
+    unlink(i);
+}
+
+void Phylogeny::setParent(int i, int parent){
+    if (parents[i] == parent){
+        return;
+    }
+    unlink(i);
+    link(i, parent);
+}
+
+void Phylogeny::link(int i, int parent){
+    parents[i] = parent;
+    prev_sibling[i] = NONE;
+    if (parent == NONE){
+        next_sibling[i] = NONE;
+        return;
+    }
+    next_sibling[i] = first_child[parent];
+    if (first_child[parent] != NONE){
+        prev_sibling[first_child[parent]] = i;
+    }
+    first_child[parent] = i;
+}
+
+void Phylogeny::unlink(int i){
+    int parent = parents[i];
+    if (parent == NONE){
+        return;
+    }
+    if (prev_sibling[i] != NONE){
+        next_sibling[prev_sibling[i]] = next_sibling[i];
+    }
+    else{
+        first_child[parent] = next_sibling[i];
+    }
+    if (next_sibling[i] != NONE){
+        prev_sibling[next_sibling[i]] = prev_sibling[i];
+    }
+    parents[i] = NONE;
+    next_sibling[i] = NONE;
+    prev_sibling[i] = NONE;
+}
+
+void Phylogeny::clear(){
+    parents.clear();
+    first_child.clear();
+    next_sibling.clear();
+    prev_sibling.clear();
+    depths.clear();
+    mut_effects.clear();
+}
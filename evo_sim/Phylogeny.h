@@ -0,0 +1,73 @@
+//
+//  Phylogeny.h
+//  evo_sim
+//
+//  Parent/child edges, depth and mutation effect of the CellTypes of a population, in arrays by type index.
+//
+
+#ifndef Phylogeny_h
+#define Phylogeny_h
+
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+class Phylogeny{
+    /* the type tree of one CList. node i is the CellType with type index i.
+     children are linked through first_child/next_sibling (prev_sibling makes unlinking O(1)), so adding, moving and removing a node never scans a child list.
+     arrays grow to the largest type index in use, which stays near the number of live types because CList hands out the lowest free index.
+     */
+private:
+    vector<int> parents;
+    vector<int> first_child;
+    vector<int> next_sibling;
+    vector<int> prev_sibling;
+    vector<int> depths;
+    vector<double> mut_effects;
+    void link(int i, int parent);
+    void unlink(int i);
+public:
+    static const int NONE = -1;
+
+    /* adds node i under parent, at one below the parent's depth, with no mutation effect.
+     @param parent index of the parent node, NONE for a root
+     */
+    void addNode(int i, int parent);
+
+    // removes node i, which must have no children
+    void removeNode(int i);
+
+    // moves node i and its subtree under parent. depths are left as they are.
+    void setParent(int i, int parent);
+
+    // forgets every node. keeps the allocated arrays.
+    void clear();
+
+    int getParent(int i){
+        return parents[i];
+    }
+    int getFirstChild(int i){
+        return first_child[i];
+    }
+    int getNextSibling(int i){
+        return next_sibling[i];
+    }
+    bool hasChildren(int i){
+        return first_child[i] != NONE;
+    }
+    int getDepth(int i){
+        return depths[i];
+    }
+    void setDepth(int i, int depth){
+        depths[i] = depth;
+    }
+    double getMutEffect(int i){
+        return mut_effects[i];
+    }
+    void setMutEffect(int i, double mut_effect){
+        mut_effects[i] = mut_effect;
+    }
+};
+
+#endif /* Phylogeny_h */
@@ -0,0 +1,72 @@
+//
+//  SlabPool.cpp
+//  evo_sim
+//
+//  Per-population allocator for the Clones and CellTypes created and destroyed during a simulation.
+//
+
+#include "SlabPool.h"
+#include <vector>
+#include <new>
+
+using namespace std;
+
+__thread SlabPool *slab_pool;
+
+SlabPool::SlabPool(){
+    curr_slab = 0;
+    slab_used = 0;
+    for (int i=0; i<NUM_CLASSES; i++){
+        free_lists[i] = NULL;
+    }
+}
+
+SlabPool::~SlabPool(){
+    for (vector<char *>::iterator it = slabs.begin(); it != slabs.end(); ++it){
+        ::operator delete(*it);
+    }
+}
+
+void *SlabPool::allocate(size_t size){
+    if (size > MAX_BLOCK){
+        return ::operator new(size);
+    }
+    int size_class = sizeClass(size);
+    void *block = free_lists[size_class];
+    if (block){
+        free_lists[size_class] = *(void **)block;
+        return block;
+    }
+    size_t block_size = (size_class + 1) * GRANULE;
+    if (curr_slab < slabs.size() && slab_used + block_size > SLAB_SIZE){
+        curr_slab++;
+        slab_used = 0;
+    }
+    if (curr_slab == slabs.size()){
+        slabs.push_back((char *)::operator new(SLAB_SIZE));
+    }
+    block = slabs[curr_slab] + slab_used;
+    slab_used += block_size;
+    return block;
+}
+
+void SlabPool::deallocate(void *block, size_t size){
+    if (!block){
+        return;
+    }
+    if (size > MAX_BLOCK){
+        ::operator delete(block);
+        return;
+    }
+    int size_class = sizeClass(size);
+    *(void **)block = free_lists[size_class];
+    free_lists[size_class] = block;
+}
+
+void SlabPool::releaseAll(){
+    for (int i=0; i<NUM_CLASSES; i++){
+        free_lists[i] = NULL;
+    }
+    curr_slab = 0;
+    slab_used = 0;
+}
@@ -0,0 +1,51 @@
+//
+//  SlabPool.h
+//  evo_sim
+//
+//  Per-population allocator for the Clones and CellTypes created and destroyed during a simulation.
+//
+
+#ifndef SlabPool_h
+#define SlabPool_h
+
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+class SlabPool{
+    /* hands out small fixed-size blocks carved from large slabs. freed blocks go on one free list per size class and are reused by the next allocation of that class, so divisions and deaths do not go through malloc.
+     releaseAll returns every block at once and keeps the slabs for the next run.
+     requests larger than MAX_BLOCK go to the global heap.
+     */
+private:
+    static const size_t GRANULE = 16;
+    static const size_t MAX_BLOCK = 512;
+    static const size_t SLAB_SIZE = 1 << 16;
+    static const int NUM_CLASSES = MAX_BLOCK / GRANULE;
+    vector<char *> slabs;
+    // slab currently being carved and how much of it is handed out
+    size_t curr_slab;
+    size_t slab_used;
+    // heads of the free lists, linked through the first word of each free block
+    void *free_lists[NUM_CLASSES];
+    static int sizeClass(size_t size){
+        return (size - 1) / GRANULE;
+    }
+public:
+    SlabPool();
+    ~SlabPool();
+
+    void *allocate(size_t size);
+
+    // @param size must be the size passed to allocate for this block
+    void deallocate(void *block, size_t size);
+
+    // makes every block available again without visiting them. any object still in use is invalidated.
+    void releaseAll();
+};
+
+// pool of the population simulated by this thread. set by the CList constructor, NULL when no population owns the thread.
+extern __thread SlabPool *slab_pool;
+
+#endif /* SlabPool_h */
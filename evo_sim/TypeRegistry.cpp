@@ -0,0 +1,82 @@
+//
+//  TypeRegistry.cpp
+//  evo_sim
+//
+//  CellType lookup by type index for CList, without storage proportional to max_types.
+//
+
+#include "TypeRegistry.h"
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+TypeRegistry::TypeRegistry(){
+    capacity = 0;
+    cursor = 0;
+    index_end = 0;
+}
+
+TypeRegistry::~TypeRegistry(){
+    for (vector<CellType **>::iterator it = pages.begin(); it != pages.end(); ++it){
+        delete [] *it;
+    }
+}
+
+void TypeRegistry::setCapacity(int max){
+    clear();
+    capacity = max;
+}
+
+void TypeRegistry::set(int i, CellType *type){
+    if (i < 0 || i >= capacity){
+        throw std::out_of_range("type index");
+    }
+    int page = i >> PAGE_BITS;
+    if (page >= (int)pages.size()){
+        pages.resize(page + 1, NULL);
+    }
+    if (!pages[page]){
+        pages[page] = new CellType*[PAGE_SIZE]();
+        used_pages.push_back(page);
+    }
+    pages[page][i & (PAGE_SIZE - 1)] = type;
+    if (type && i >= index_end){
+        index_end = i + 1;
+    }
+}
+
+void TypeRegistry::release(int i){
+    set(i, NULL);
+    if (i < cursor){
+        released.push(i);
+    }
+}
+
+int TypeRegistry::nextFree(){
+    // released indices may have been taken again by an explicit set()
+    while (!released.empty()){
+        int i = released.top();
+        released.pop();
+        if (!get(i)){
+            released.push(i);
+            return i;
+        }
+    }
+    while (cursor < capacity && get(cursor)){
+        cursor++;
+    }
+    if (cursor == capacity){
+        return -1;
+    }
+    return cursor;
+}
+
+void TypeRegistry::clear(){
+    for (vector<int>::iterator it = used_pages.begin(); it != used_pages.end(); ++it){
+        fill(pages[*it], pages[*it] + PAGE_SIZE, (CellType *)NULL);
+    }
+    cursor = 0;
+    released = priority_queue<int, vector<int>, greater<int> >();
+    index_end = 0;
+}
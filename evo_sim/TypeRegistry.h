@@ -0,0 +1,78 @@
+//
+//  TypeRegistry.h
+//  evo_sim
+//
+//  CellType lookup by type index for CList, without storage proportional to max_types.
+//
+
+#ifndef TypeRegistry_h
+#define TypeRegistry_h
+
+#include <stdio.h>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <stdexcept>
+
+using namespace std;
+
+class CellType;
+
+class TypeRegistry{
+    /* maps type indices to the CellTypes of a population.
+     pointers are kept in pages of PAGE_SIZE that are allocated when a type first lands in them, so a max_types of 10^8 costs nothing until those types exist.
+     free indices are handed out lowest first: indices below cursor are taken unless they were released, and released indices sit in a min-heap, so release and reuse cost O(log r) in the r released indices. a fresh index past cursor is amortized O(1).
+     */
+private:
+    static const int PAGE_BITS = 12;
+    static const int PAGE_SIZE = 1 << PAGE_BITS;
+    vector<CellType **> pages;
+    // pages allocated so far, cleared by clear() instead of freed
+    vector<int> used_pages;
+    int capacity;
+    int cursor;
+    // indices given back with release() below cursor
+    priority_queue<int, vector<int>, greater<int> > released;
+    // one past the largest index ever set since the last clear()
+    int index_end;
+public:
+    TypeRegistry();
+    ~TypeRegistry();
+
+    // sets the number of usable indices (max_types) and forgets every type
+    void setCapacity(int max);
+    int getCapacity(){
+        return capacity;
+    }
+
+    /* @return type at index i, NULL if there is none
+     throws out_of_range if i is not below the capacity, like vector::at
+     */
+    CellType* get(int i){
+        if (i < 0 || i >= capacity){
+            throw std::out_of_range("type index");
+        }
+        int page = i >> PAGE_BITS;
+        if (page >= (int)pages.size() || !pages[page]){
+            return NULL;
+        }
+        return pages[page][i & (PAGE_SIZE - 1)];
+    }
+
+    void set(int i, CellType *type);
+
+    // frees index i for reuse by nextFree. O(log r) in the released indices
+    void release(int i);
+
+    // @return lowest free index, or -1 if all capacity indices are taken. O(log r) when a released index is reused
+    int nextFree();
+
+    int getIndexEnd(){
+        return index_end;
+    }
+
+    // forgets every type. keeps the allocated pages.
+    void clear();
+};
+
+#endif /* TypeRegistry_h */
@@ -0,0 +1,163 @@
+#!/bin/bash
+# runs the inputs in this folder with their fixed seeds and compares summary statistics of each faster engine
+# with the engine it stands in for, or with the closed form where there is one.
+# a statistic passes if it is within 4 standard errors.
+# usage: check.sh [evo_sim executable] [number of threads]
+
+here=$(cd "$(dirname "$0")" && pwd)
+bin=${1:-$here/../../build/evo_sim}
+threads=${2:-4}
+out=$(mktemp -d)
+failed=0
+
+# run input model: writes the output into $out/input_model/. an input already run with a model is not run again.
+# inputs written by variant are read from $out, the others from this folder.
+run(){
+    if [ -d $out/$1_$2 ]; then
+        return
+    fi
+    input=$here/$1.ievo
+    if [ -f $out/$1.ievo ]; then
+        input=$out/$1.ievo
+    fi
+    mkdir -p $out/$1_$2
+    if ! $bin -i $input -o $out/$1_$2/ -m $2 -n $threads > $out/$1_$2/stdout.txt; then
+        echo "FAIL $1 -m $2 did not run"
+        failed=1
+    fi
+}
+
+# variant input name line: writes the input with one more line as $out/name.ievo, to run as name
+variant(){
+    { cat $here/$1.ievo; echo "$3"; } > $out/$2.ievo
+}
+
+# cells of one type at the end of each trial, from an EndPopTypes file
+type_cells(){
+    awk -F', ' -v type=$2 'NF==1{if (seen) print cells; seen=1; cells=0; next} $1==type{cells=$2} END{if (seen) print cells}' $1
+}
+
+# second column of a one row per trial writer, such as EndTime or IsExtinct
+trial_values(){
+    awk -F', ' '{print $2}' $1
+}
+
+# 1 for the trials where the value is positive
+fixed(){
+    awk '{print ($1 > 0)}'
+}
+
+# count, mean and variance of a column of numbers
+summary(){
+    awk '{n++; s+=$1; ss+=$1*$1} END{m=s/n; v=n>1 ? (ss-n*m*m)/(n-1) : 0; print n, m, v}'
+}
+
+# compare name summary_a summary_b: both sides are sampled
+compare(){
+    read n1 m1 v1 <<< "$2"
+    read n2 m2 v2 <<< "$3"
+    verdict=$(awk -v n1=$n1 -v m1=$m1 -v v1=$v1 -v n2=$n2 -v m2=$m2 -v v2=$v2 'BEGIN{se=sqrt(v1/n1+v2/n2); d=m1-m2; if (d<0) d=-d; print (d <= 4*se) ? "PASS" : "FAIL"}')
+    echo "$verdict $1: $m1 vs $m2 ($n1 and $n2 trials)"
+    [ $verdict = PASS ] || failed=1
+}
+
+# expect name summary mean variance: compares the sample mean and variance with exact values
+expect(){
+    read n m v <<< "$2"
+    verdict=$(awk -v n=$n -v m=$m -v v=$v -v em=$3 -v ev=$4 'BEGIN{dm=m-em; if (dm<0) dm=-dm; dv=v-ev; if (dv<0) dv=-dv; print (dm <= 4*sqrt(ev/n) && dv <= 4*ev*sqrt(2/(n-1))) ? "PASS" : "FAIL"}')
+    echo "$verdict $1: mean $m variance $v, exact $3 and $4 ($n trials)"
+    [ $verdict = PASS ] || failed=1
+}
+
+# Wright-Fisher resampling against Moran steps: a neutral type fixes with its starting frequency
+run neutral_fixation wright_fisher
+run neutral_fixation moran
+compare "wright_fisher neutral fixation" "$(type_cells $out/neutral_fixation_wright_fisher/end_pop_types.oevo 1 | fixed | summary)" "$(type_cells $out/neutral_fixation_moran/end_pop_types.oevo 1 | fixed | summary)"
+
+# the embedded chain against plain Moran events: fixation probability and time of one fitter cell
+run embedded_chain moran
+run selective_fixation moran
+compare "embedded chain fixation" "$(type_cells $out/embedded_chain_moran/end_pop_types.oevo 1 | fixed | summary)" "$(type_cells $out/selective_fixation_moran/end_pop_types.oevo 1 | fixed | summary)"
+compare "embedded chain end time" "$(trial_values $out/embedded_chain_moran/end_time.oevo | summary)" "$(trial_values $out/selective_fixation_moran/end_time.oevo | summary)"
+
+# hypergeometric passages against the exact distribution of the cells a uniform sample keeps
+run passage passage
+expect "passage type 1 cells" "$(type_cells $out/passage_passage/end_pop_types.oevo 1 | summary)" 300 189.02
+
+# the next reaction method against the exact branching process
+run branching branching_nrm
+run branching branching
+compare "branching_nrm extinction" "$(trial_values $out/branching_branching_nrm/extinction.oevo | summary)" "$(trial_values $out/branching_branching/extinction.oevo | summary)"
+compare "branching_nrm end time" "$(trial_values $out/branching_branching_nrm/end_time.oevo | summary)" "$(trial_values $out/branching_branching/end_time.oevo | summary)"
+compare "branching_nrm type 1 cells" "$(type_cells $out/branching_branching_nrm/end_pop_types.oevo 1 | summary)" "$(type_cells $out/branching_branching/end_pop_types.oevo 1 | summary)"
+
+# tau leaping against the exact branching process: a large growing population, and a critical one just above the leaping threshold
+run growth branching_tau
+run growth branching
+compare "branching_tau cells" "$(trial_values $out/growth_branching_tau/end_pop.oevo | summary)" "$(trial_values $out/growth_branching/end_pop.oevo | summary)"
+compare "branching_tau type 1 cells" "$(type_cells $out/growth_branching_tau/end_pop_types.oevo 1 | summary)" "$(type_cells $out/growth_branching/end_pop_types.oevo 1 | summary)"
+run critical branching_tau
+run critical branching
+compare "branching_tau critical extinction" "$(trial_values $out/critical_branching_tau/extinction.oevo | summary)" "$(trial_values $out/critical_branching/extinction.oevo | summary)"
+compare "branching_tau critical cells" "$(trial_values $out/critical_branching_tau/end_pop.oevo | summary)" "$(trial_values $out/critical_branching/end_pop.oevo | summary)"
+
+# the hybrid engine against the exact branching process: large clones grow deterministically, their mutants are drawn exactly
+run growth branching_hybrid
+run growth branching
+compare "branching_hybrid cells" "$(trial_values $out/growth_branching_hybrid/end_pop.oevo | summary)" "$(trial_values $out/growth_branching/end_pop.oevo | summary)"
+compare "branching_hybrid type 1 cells" "$(type_cells $out/growth_branching_hybrid/end_pop_types.oevo 1 | summary)" "$(type_cells $out/growth_branching/end_pop_types.oevo 1 | summary)"
+
+# analytic jumps against the exact branching process: clone sizes are drawn in closed form between mutations
+run growth branching_jump
+run growth branching
+compare "branching_jump cells" "$(trial_values $out/growth_branching_jump/end_pop.oevo | summary)" "$(trial_values $out/growth_branching/end_pop.oevo | summary)"
+compare "branching_jump type 1 cells" "$(type_cells $out/growth_branching_jump/end_pop_types.oevo 1 | summary)" "$(type_cells $out/growth_branching/end_pop_types.oevo 1 | summary)"
+run critical branching_jump
+run critical branching
+compare "branching_jump critical extinction" "$(trial_values $out/critical_branching_jump/extinction.oevo | summary)" "$(trial_values $out/critical_branching/extinction.oevo | summary)"
+compare "branching_jump critical cells" "$(trial_values $out/critical_branching_jump/end_pop.oevo | summary)" "$(trial_values $out/critical_branching/end_pop.oevo | summary)"
+
+# per cell slots against plain Moran events: the dead cell is looked up by slot instead of by walking the clones
+run selective_fixation moran_slots
+run selective_fixation moran
+compare "moran_slots fixation" "$(type_cells $out/selective_fixation_moran_slots/end_pop_types.oevo 1 | fixed | summary)" "$(type_cells $out/selective_fixation_moran/end_pop_types.oevo 1 | fixed | summary)"
+compare "moran_slots end time" "$(trial_values $out/selective_fixation_moran_slots/end_time.oevo | summary)" "$(trial_values $out/selective_fixation_moran/end_time.oevo | summary)"
+
+# the Fenwick clone index against the linear walk over clones, with one HeritableClone per cell
+variant heritable heritable_fenwick "pop_params sampler fenwick"
+run heritable_fenwick branching
+run heritable branching
+compare "sampler fenwick extinction" "$(trial_values $out/heritable_fenwick_branching/extinction.oevo | summary)" "$(trial_values $out/heritable_branching/extinction.oevo | summary)"
+compare "sampler fenwick end time" "$(trial_values $out/heritable_fenwick_branching/end_time.oevo | summary)" "$(trial_values $out/heritable_branching/end_time.oevo | summary)"
+
+# the composition-rejection clone index against the linear walk over clones
+variant heritable heritable_composition "pop_params sampler composition"
+run heritable_composition branching
+run heritable branching
+compare "sampler composition extinction" "$(trial_values $out/heritable_composition_branching/extinction.oevo | summary)" "$(trial_values $out/heritable_branching/extinction.oevo | summary)"
+compare "sampler composition end time" "$(trial_values $out/heritable_composition_branching/end_time.oevo | summary)" "$(trial_values $out/heritable_branching/end_time.oevo | summary)"
+
+# the blocked prefix scan against the linear walk over clones
+variant heritable heritable_scan "pop_params sampler scan"
+run heritable_scan branching
+run heritable branching
+compare "sampler scan extinction" "$(trial_values $out/heritable_scan_branching/extinction.oevo | summary)" "$(trial_values $out/heritable_branching/extinction.oevo | summary)"
+compare "sampler scan end time" "$(trial_values $out/heritable_scan_branching/end_time.oevo | summary)" "$(trial_values $out/heritable_branching/end_time.oevo | summary)"
+
+# the adaptive index against the Fenwick tree, on a population large enough to make it switch from scanning to the tree
+variant heritable_large heritable_large_auto "pop_params sampler auto"
+variant heritable_large heritable_large_fenwick "pop_params sampler fenwick"
+run heritable_large_auto branching
+run heritable_large_fenwick branching
+compare "sampler auto extinction" "$(trial_values $out/heritable_large_auto_branching/extinction.oevo | summary)" "$(trial_values $out/heritable_large_fenwick_branching/extinction.oevo | summary)"
+compare "sampler auto end time" "$(trial_values $out/heritable_large_auto_branching/end_time.oevo | summary)" "$(trial_values $out/heritable_large_fenwick_branching/end_time.oevo | summary)"
+
+# clones merged into log birth rate bins against unmerged clones. the clone limit is low so merging starts early in each trial.
+variant heritable heritable_bins "pop_params rate_bins log 0.05 50"
+run heritable_bins branching
+run heritable branching
+compare "rate_bins extinction" "$(trial_values $out/heritable_bins_branching/extinction.oevo | summary)" "$(trial_values $out/heritable_branching/extinction.oevo | summary)"
+compare "rate_bins end time" "$(trial_values $out/heritable_bins_branching/end_time.oevo | summary)" "$(trial_values $out/heritable_branching/end_time.oevo | summary)"
+
+rm -rf $out
+exit $failed
@@ -11,6 +11,8 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <limits>
+#include <typeinfo>
 #include <pthread.h>
 
 
@@ -19,6 +21,7 @@
 #include "CList.h"
 #include "OutputWriter.h"
 #include "MutationHandler.h"
+#include "SlabPool.h"
 
 // common RNG that is thread safe
 __thread std::mt19937 *eng;
@@ -46,9 +49,27 @@ void *sim_thread(void *arg){
     if (model_type == "moran"){
         clone_list = new MoranPop();
     }
+    else if (model_type == "moran_slots"){
+        clone_list = new MoranSlotPop();
+    }
+    else if (model_type == "wright_fisher"){
+        clone_list = new WrightFisherPop();
+    }
     else if (model_type == "branching"){
         clone_list = new CList();
     }
+    else if (model_type == "branching_nrm"){
+        clone_list = new NRMPop();
+    }
+    else if (model_type == "branching_tau"){
+        clone_list = new TauLeapPop();
+    }
+    else if (model_type == "branching_hybrid"){
+        clone_list = new HybridPop();
+    }
+    else if (model_type == "branching_jump"){
+        clone_list = new JumpPop();
+    }
     else if (model_type == "update"){
         clone_list = new UpdateAllPop();
     }
@@ -78,6 +99,10 @@ void *sim_thread(void *arg){
     int sim_num = data->getSimNumberAndAdvance();
     
     while (sim_num <= params.getNumSims()){
+        if (params.getSeed() >= 0){
+            // trial sim_num always gets the same stream, whatever thread runs it
+            eng->seed(params.getSeed() + sim_num);
+        }
         infile.open(infilename);
         params.refreshSim(infile);
         infile.close();
@@ -180,30 +205,37 @@ int ThreadInput::getSimNumberAndAdvance(){
 
 CellType::CellType(int i, CellType *parent_type){
     index = i;
-    total_birth_rate = 0;
-    parent = parent_type;
-    children = std::vector<CellType *>();
+    total_birth_rate.set(0);
     if (parent_type){
-        empirical_dist = *parent_type->getEmpiricalDist();
-        phylogeny_depth = parent_type->getDepth() + 1;
+        empirical_dist = parent_type->empirical_dist;
+        // a mutant always joins its parent's population. root types get their node from CList::insertCellType.
+        clone_list = parent_type->clone_list;
+        clone_list->phylogeny.addNode(i, parent_type->index);
     }
     else{
-        phylogeny_depth = 0;
+        clone_list = NULL;
     }
     num_cells = 0;
-    root_node = NULL;
-    end_node = NULL;
     prev_node = NULL;
     next_node = NULL;
+    active_prev = NULL;
+    active_next = NULL;
+    is_active = false;
+    prune_queued = false;
+    is_root = false;
+    birth_time = 0;
+    extinct_time = 0;
     has_death_rate = false;
     death = 0.0;
-    mutation_effect = 0;
+    divs_to_mut = -1;
+    divs_mut_prob = 0;
 }
 
 void CellType::setDeathRate(double death_rate){
     has_death_rate = true;
     death = death_rate;
     clone_list->death_var = true;
+    clone_list->deathRatesChanged();
 }
 
 double CellType::getDeathRate(){
@@ -217,51 +249,113 @@ double CellType::getDeathRate(){
 
 void CellType::subtractOneCell(double b){
     num_cells --;
-    total_birth_rate-=b;
+    total_birth_rate.add(-b);
     /*
     if (isExtinct()){
         unlinkType();
     }
      */
-    clone_list->removeCell(b);
+    clone_list->removeCell(b, getDeathRate());
+    if (num_cells == 0){
+        clone_list->deactivateType(*this);
+    }
 }
 
-void CellType::addChild(CellType &child_type){
-    bool has_child = false;
-    for (vector<CellType *>::iterator it = children.begin(); it != children.end(); ++it){
-        if ((*it)->getIndex() == child_type.getIndex()){
-            has_child = true;
-        }
+void CellType::subtractCells(int num, double b){
+    num_cells -= num;
+    total_birth_rate.add(-b);
+    clone_list->removeCells(num, b, num * getDeathRate());
+    if (num_cells == 0){
+        clone_list->deactivateType(*this);
+    }
+}
+
+CellType* CellType::getParent(){
+    int parent_index = clone_list->phylogeny.getParent(index);
+    if (parent_index == Phylogeny::NONE){
+        return NULL;
     }
-    if (!has_child){
-        children.push_back(&child_type);
+    return clone_list->getTypeByIndex(parent_index);
+}
+
+CellType* CellType::getFirstChild(){
+    int child = clone_list->phylogeny.getFirstChild(index);
+    if (child == Phylogeny::NONE){
+        return NULL;
     }
+    return clone_list->getTypeByIndex(child);
+}
+
+CellType* CellType::getNextSibling(){
+    int sibling = clone_list->phylogeny.getNextSibling(index);
+    if (sibling == Phylogeny::NONE){
+        return NULL;
+    }
+    return clone_list->getTypeByIndex(sibling);
+}
+
+void CellType::setParent(CellType *parent_type){
+    clone_list->phylogeny.setParent(index, parent_type ? parent_type->index : Phylogeny::NONE);
+}
+
+int CellType::getDepth(){
+    return clone_list->phylogeny.getDepth(index);
+}
+
+void CellType::setDepth(int new_depth){
+    clone_list->phylogeny.setDepth(index, new_depth);
+}
+
+double CellType::getMutEffect(){
+    return clone_list->phylogeny.getMutEffect(index);
+}
+
+void CellType::setMutEffect(double mut_effect){
+    clone_list->phylogeny.setMutEffect(index, mut_effect);
 }
 
 void CellType::addCells(int num, double b){
     num_cells += num;
-    total_birth_rate += b;
+    total_birth_rate.add(b);
     
-    clone_list->addCells(num, b);
+    clone_list->addCells(num, b, num * getDeathRate());
+    if (!is_active && num_cells > 0){
+        clone_list->activateType(*this);
+    }
 }
 
 CellType::~CellType(){
-    Clone *to_delete = root_node;
-    Clone *next;
-    while (to_delete){
-        next = &to_delete->getNextWithinType();
-        delete to_delete;
-        to_delete = next;
+    // each clone removes itself from the back of the arrays
+    while (!clones.empty()){
+        delete clones.back();
+    }
+}
+
+void *CellType::operator new(size_t size){
+    if (slab_pool){
+        return slab_pool->allocate(size);
+    }
+    return ::operator new(size);
+}
+
+void CellType::operator delete(void *block, size_t size){
+    if (slab_pool){
+        slab_pool->deallocate(block, size);
+    }
+    else{
+        ::operator delete(block);
     }
 }
 
 void CellType::unlinkType(){
     if (next_node){
-        next_node->setPrev(*prev_node);
+        next_node->prev_node = prev_node;
     }
     if (prev_node){
-        prev_node->setNext(*next_node);
+        prev_node->next_node = next_node;
     }
+    prev_node = NULL;
+    next_node = NULL;
 }
 
 MutationHandler& CellType::getMutHandler(){
@@ -270,15 +364,120 @@ MutationHandler& CellType::getMutHandler(){
 
 void CellType::insertClone(Clone &new_clone){
     addCells(new_clone.getCellCount(), new_clone.getTotalBirth());
-    if (!root_node){
-        root_node = &new_clone;
-        end_node = &new_clone;
+    storeClone(new_clone);
+    clone_list->cloneInserted(new_clone);
+}
+
+void CellType::storeClone(Clone& clone){
+    clone.setTypeSlot(clones.size());
+    clones.push_back(&clone);
+    clone_births.push_back(clone.getTotalBirth());
+    clone_counts.push_back(clone.getCellCount());
+    clone_muts.push_back(clone.getMutProb());
+    clone_kinds.push_back(typeid(clone));
+    if (!clone.canMerge()){
+        // never indexed. NaN also keeps getBirthRate from being called on clones where it draws a random rate.
+        clone_rates.push_back(numeric_limits<double>::quiet_NaN());
+        return;
+    }
+    clone_rates.push_back(clone.getBirthRate());
+    CloneKey key(clone_rates.back(), clone_muts.back(), clone_kinds.back());
+    if (identical_clones.find(key) == identical_clones.end()){
+        identical_clones[key] = &clone;
     }
-    else{
-        end_node->setNext(&new_clone);
-        new_clone.setPrev(end_node);
-        end_node = &new_clone;
+}
+
+Clone* CellType::findIdentical(double b, double mut, const std::type_info& kind){
+    unordered_map<CloneKey, Clone *, CloneKeyHash>::iterator found = identical_clones.find(CloneKey(b, mut, kind));
+    if (found == identical_clones.end()){
+        return NULL;
+    }
+    return found->second;
+}
+
+void CellType::mergeClone(Clone& new_clone){
+    Clone *existing = NULL;
+    if (new_clone.canMerge()){
+        new_clone.setBirthRate(clone_list->mergeRate(new_clone.getBirthRate()));
+        existing = findIdentical(new_clone.getBirthRate(), new_clone.getMutProb(), typeid(new_clone));
+    }
+    if (!existing){
+        insertClone(new_clone);
+        return;
+    }
+    existing->addCells(new_clone.getCellCount());
+    // new_clone was never stored, so deleting it does not touch the totals
+    delete &new_clone;
+}
+
+void CellType::rejoinClone(Clone& clone){
+    if (!clone.canMerge()){
+        return;
+    }
+    double b = clone_list->mergeRate(clone.getBirthRate());
+    if (b != clone.getBirthRate()){
+        clone.setBirthRate(b);
+    }
+    Clone *existing = findIdentical(b, clone.getMutProb(), typeid(clone));
+    if (!existing || existing == &clone){
+        return;
     }
+    long long num = clone.getCellCount();
+    existing->addCells(num);
+    clone.removeCells(num);
+}
+
+void CellType::updateClone(Clone& clone){
+    int slot = clone.getTypeSlot();
+    if (slot < 0){
+        return;
+    }
+    clone_births[slot] = clone.getTotalBirth();
+    clone_counts[slot] = clone.getCellCount();
+    if (std::isnan(clone_rates[slot]) || clone_rates[slot] == clone.getBirthRate()){
+        return;
+    }
+    // the birth rate changed, so move the clone's index entry if it holds one
+    unordered_map<CloneKey, Clone *, CloneKeyHash>::iterator found = identical_clones.find(CloneKey(clone_rates[slot], clone_muts[slot], clone_kinds[slot]));
+    clone_rates[slot] = clone.getBirthRate();
+    if (found == identical_clones.end() || found->second != &clone){
+        return;
+    }
+    identical_clones.erase(found);
+    CloneKey key(clone_rates[slot], clone_muts[slot], clone_kinds[slot]);
+    if (identical_clones.find(key) == identical_clones.end()){
+        identical_clones[key] = &clone;
+    }
+}
+
+void CellType::dropClone(Clone& clone){
+    int slot = clone.getTypeSlot();
+    if (slot < 0){
+        return;
+    }
+    if (!std::isnan(clone_rates[slot])){
+        unordered_map<CloneKey, Clone *, CloneKeyHash>::iterator found = identical_clones.find(CloneKey(clone_rates[slot], clone_muts[slot], clone_kinds[slot]));
+        if (found != identical_clones.end() && found->second == &clone){
+            identical_clones.erase(found);
+        }
+    }
+    int last = clones.size() - 1;
+    if (slot != last){
+        clones[slot] = clones[last];
+        clone_births[slot] = clone_births[last];
+        clone_counts[slot] = clone_counts[last];
+        clone_muts[slot] = clone_muts[last];
+        clone_rates[slot] = clone_rates[last];
+        clone_kinds[slot] = clone_kinds[last];
+        clones[slot]->setTypeSlot(slot);
+    }
+    clones.pop_back();
+    clone_births.pop_back();
+    clone_counts.pop_back();
+    clone_muts.pop_back();
+    clone_rates.pop_back();
+    clone_kinds.pop_back();
+    clone.setTypeSlot(-1);
 }
 
 //----------EndListeners----------------
@@ -367,6 +566,7 @@ CompositeListener::~CompositeListener(){
 
 SimParams::SimParams(CList& clist, vector<OutputWriter*>& writer_list, CompositeListener& listener, string& output, string& sim_type){
     num_simulations = 0;
+    seed = -1;
     mut_handler = NULL;
     err_type = "";
     err_line = 0;
@@ -526,7 +726,7 @@ bool SimParams::handle_line(string& line){
 
         }
         has_dist->push_back(stoi(parsed_line[0]));
-        dists->push_back(*new vector<int>());
+        dists->push_back(vector<int>());
         ifstream infile;
         infile.open(parsed_line[1]);
         if (!infile.is_open()){
@@ -713,6 +913,9 @@ bool SimParams::make_writer(vector<string> &parsed_line){
     else if (type == "EndPop"){
         new_writer = new EndPopWriter(*outfolder);
     }
+    else if (type == "RateDrift"){
+        new_writer = new RateDriftWriter(*outfolder);
+    }
     else if (type == "EndPopTypes"){
         new_writer = new EndPopTypesWriter(*outfolder);
     }
@@ -766,12 +969,12 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         return false;
     }
     CellType *new_type = new CellType(type_id, NULL);
-    new_type->setDepth(new_depth);
     
     int num_cells =stoi(parsed_line[1]);
     
     clone_list->addRootType(*new_type);
     clone_list->insertCellType(*new_type);
+    new_type->setDepth(new_depth);
     parsed_line.erase(parsed_line.begin());
     if (type == "Simple"){
         if (parsed_line.size() < 3){
@@ -791,7 +994,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         }
         TypeSpecificClone *new_clone;
         for (int i=0; i<num_cells; i++){
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new TypeSpecificClone(*new_type, true);
             }
             else{
@@ -849,7 +1052,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
             
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HeritableClone(*new_type, true);
             }
             else{
@@ -870,7 +1073,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
             
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HerResetClone(*new_type, true);
             }
             else{
@@ -891,7 +1094,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
             
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HerResetExpClone(*new_type, true);
             }
             else{
@@ -912,7 +1115,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
             
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HerPoissonClone(*new_type, true);
             }
             else{
@@ -933,7 +1136,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
             
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HerResetEmpiricClone(*new_type, true);
             }
             else{
@@ -953,7 +1156,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         }
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new HerEmpiricClone(*new_type, true);
             }
             else{
@@ -973,7 +1176,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         }
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new EmpiricalDimReturnsClone(*new_type, true);
             }
             else{
@@ -992,7 +1195,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
             return false;
         }
         Clone *new_clone;
-        if (*model_type == "moran"){
+        if (isConstantSizeModel()){
             err_type = "FixedStepClone incompatible with Moran model";
             return false;
         }
@@ -1011,7 +1214,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
             return false;
         }
         Clone *new_clone;
-        if (*model_type == "moran"){
+        if (isConstantSizeModel()){
             err_type = "FixedStepClone incompatible with Moran model";
             return false;
         }
@@ -1031,7 +1234,7 @@ bool SimParams::make_clone(vector<string> &parsed_line){
         }
         Clone *new_clone;
         for (int i=0; i<num_cells; i++){
-            if (*model_type == "moran"){
+            if (isConstantSizeModel()){
                 new_clone = new TypeEmpiricClone(*new_type, true);
             }
             else{
@@ -1073,6 +1276,9 @@ bool SimParams::handle_sim_line(vector<string>& parsed_line){
     else if (parsed_line[0] == "sim_id"){
         sim_name = parsed_line[1];
     }
+    else if (parsed_line[0] == "seed"){
+        seed = stoll(parsed_line[1]);
+    }
     return true;
 }
 
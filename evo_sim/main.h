@@ -10,6 +10,9 @@
 #include <iomanip>
 #include <vector>
 #include <random>
+#include <unordered_map>
+#include <typeindex>
+#include <memory>
 
 using namespace std;
 
@@ -20,6 +23,59 @@ class Clone;
 class MutationHandler;
 class OutputWriter;
 
+class CompensatedSum{
+    /* running sum with Neumaier compensation, for rate totals that see billions of += and -= updates.
+     the rounding error of each update is carried in comp instead of being lost.
+     */
+private:
+    double sum;
+    double comp;
+public:
+    CompensatedSum(){
+        sum = 0;
+        comp = 0;
+    }
+    void add(double x){
+        double t = sum + x;
+        if (fabs(sum) >= fabs(x)){
+            comp += (sum - t) + x;
+        }
+        else{
+            comp += (x - t) + sum;
+        }
+        sum = t;
+    }
+    void set(double x){
+        sum = x;
+        comp = 0;
+    }
+    double get(){
+        return sum + comp;
+    }
+};
+
+class CloneKey{
+    // what makes two clones of one CellType interchangeable: per cell birth rate, mutation probability and Clone class
+public:
+    double birth_rate;
+    double mut_prob;
+    std::type_index kind;
+    CloneKey(double b, double mut, std::type_index clone_kind) : birth_rate(b), mut_prob(mut), kind(clone_kind){}
+    bool operator==(const CloneKey& other) const{
+        return birth_rate == other.birth_rate && mut_prob == other.mut_prob && kind == other.kind;
+    }
+};
+
+class CloneKeyHash{
+public:
+    size_t operator()(const CloneKey& key) const{
+        size_t h = std::hash<double>()(key.birth_rate);
+        h ^= std::hash<double>()(key.mut_prob) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h ^= key.kind.hash_code() + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
 class ThreadInput{
     /* a datatype for passing in arguments to multiple simulation worker threads.
      should be able to be shared as a single instance for all threads.
@@ -58,24 +114,44 @@ public:
 class CellType{
     /* represents a functional subset of cells in the population (e.g. cells with a specific mutation, phenotype, etc)
      distinct from fitness- cells with different birth rates can have the same type
-     tracks the type history/phylogeny and number of cells by type
+     tracks the number of cells by type. the type history/phylogeny is kept by the CList (see Phylogeny) and reached through the accessors below.
      */
     friend class CList;
     friend class Clone;
 private:
-    CellType *parent;
-    std::vector<CellType *> children;
     CellType *prev_node;
     CellType *next_node;
-    Clone *root_node;
-    Clone *end_node;
+    // links in the CList list of types with cells (see CList::activateType)
+    CellType *active_prev;
+    CellType *active_next;
+    bool is_active;
+    // true while the type waits in CList::prune_candidates
+    bool prune_queued;
+    // set by CList::addRootType. root types are never pruned.
+    bool is_root;
+    // time the type entered the population, and the time it last lost its last cell
+    double birth_time;
+    double extinct_time;
+    // clones of this type, packed: clones[i] has type slot i and a removal moves the last clone into the hole
+    std::vector<Clone *> clones;
+    // TOTAL birth rate, cell count and mutation probability of clones[i]. kept next to each other so scans over a type read contiguous memory.
+    std::vector<double> clone_births;
+    std::vector<long long> clone_counts;
+    std::vector<double> clone_muts;
+    // per cell birth rate of clones[i] when it was last stored or updated. locates the clone's entry in identical_clones.
+    std::vector<double> clone_rates;
+    // class of clones[i]. recorded because ~Clone no longer knows it by the time dropClone runs.
+    std::vector<std::type_index> clone_kinds;
+    // clones that canMerge(), at most one per key. entries follow their clone through updateClone and dropClone.
+    std::unordered_map<CloneKey, Clone *, CloneKeyHash> identical_clones;
     bool has_death_rate;
     double death;
+    // non-mutant divisions of clones of this type left before the next mutant division, drawn for clones with mutation probability divs_mut_prob. -1 until first drawn.
+    long long divs_to_mut;
+    double divs_mut_prob;
     int index;
     int num_cells;
-    double total_birth_rate;
-    int phylogeny_depth;
-    double mutation_effect;
+    CompensatedSum total_birth_rate;
     void unlinkType();
     void setNext(CellType& next){
         next_node = &next;
@@ -84,19 +160,17 @@ private:
         prev_node = &prev;
     }
     CList *clone_list;
-    void setRoot(Clone& new_root){
-        root_node = &new_root;
-    }
-    void setEnd(Clone& new_end){
-        end_node = &new_end;
-    }
+    void storeClone(Clone& clone);
+    void dropClone(Clone& clone);
+    // copies the current cell count and birth rate of a stored clone into the arrays. called by CList::cloneChanged.
+    void updateClone(Clone& clone);
+    // moves the cells of a stored mergeable clone, at its merge rate (see CList::mergeRate), into a stored identical clone if there is one. clone is DELETED then.
+    void rejoinClone(Clone& clone);
     void setCloneList(CList& clist){
         clone_list = &clist;
     }
-    vector<double> empirical_dist;
-    vector<double>* getEmpiricalDist(){
-        return &empirical_dist;
-    }
+    // shared with the parent type and every other type using the same distribution file. never modified once loaded.
+    std::shared_ptr<const vector<double> > empirical_dist;
 public:
     /* @param i cell type id. should be unique in the clone list typespace.
      @param parent_type cell type that formed this type, via mutation. if one of the original types in simulation, then NULL.
@@ -106,47 +180,41 @@ public:
     
     ~CellType();
     
-    /* called when a new type is formed after mutation from this parent type
-     @param child_type child to be added
-     */
-    void addChild(CellType& child_type);
+    // allocated from the slab pool of the current thread, like Clone
+    static void *operator new(size_t size);
+    static void operator delete(void *block, size_t size);
     
-    std::vector<CellType *>& getChildren(){
-        return children;
-    }
-    CellType* getParent(){
-        return parent;
-    }
-    void setMutEffect(double mut_effect){
-        mutation_effect = mut_effect;
-    }
-    double getMutEffect(){
-        return mutation_effect;
-    }
-    void setParent(CellType *parent_type){
-        parent = parent_type;
-    }
+    CellType* getParent();
+    // first child type and the next child of this type's parent, NULL at the end
+    CellType* getFirstChild();
+    CellType* getNextSibling();
+    void setMutEffect(double mut_effect);
+    double getMutEffect();
+    // moves this type to the children of parent_type
+    void setParent(CellType *parent_type);
     bool isExtinct(){
         return num_cells == 0;
     }
     int getIndex(){
         return index;
     }
-    int getDepth(){
-        return phylogeny_depth;
+    double getBirthTime(){
+        return birth_time;
     }
-    void setDepth(int new_depth){
-        phylogeny_depth = new_depth;
+    double getExtinctTime(){
+        return extinct_time;
     }
+    int getDepth();
+    void setDepth(int new_depth);
     int getNumCells(){
         return num_cells;
     }
     double getBirthRate(){
-        return total_birth_rate;
+        return total_birth_rate.get();
     }
     
     double getMeanBirthRate(){
-        return total_birth_rate/num_cells;
+        return total_birth_rate.get()/num_cells;
     }
     
     double getDeathRate();
@@ -154,28 +222,58 @@ public:
     CellType* getNext(){
         return next_node;
     }
+    // next type that has cells, in no particular order
+    CellType* getNextActive(){
+        return active_next;
+    }
     Clone* getRoot(){
-        return root_node;
+        return clones.empty() ? NULL : clones.front();
     }
     Clone* getEnd(){
-        return end_node;
+        return clones.empty() ? NULL : clones.back();
+    }
+    int getNumClones(){
+        return clones.size();
+    }
+    Clone& getClone(int i){
+        return *clones[i];
     }
+    const std::vector<double>& getCloneBirths(){
+        return clone_births;
+    }
+    const std::vector<long long>& getCloneCounts(){
+        return clone_counts;
+    }
+    const std::vector<double>& getCloneMutProbs(){
+        return clone_muts;
+    }
+    
+    /* @param kind class of the clone, as typeid(clone)
+     @return a stored mergeable clone of this type with exactly this birth rate, mutation probability and class, or NULL
+     */
+    Clone* findIdentical(double b, double mut, const std::type_info& kind);
+    
+    /* inserts new_clone into this type, unless an identical mergeable clone is stored already. then new_clone's cells are added to that clone and new_clone is DELETED.
+     a mergeable new_clone is first moved to its merge rate (see CList::mergeRate).
+     new_clone should not be used after this call.
+     */
+    void mergeClone(Clone& new_clone);
     MutationHandler& getMutHandler();
     CList& getPopulation(){
         return *clone_list;
     }
     void insertClone(Clone& new_clone);
-    void addDistPoint(double new_birth){
-        empirical_dist.push_back(new_birth);
+    void setDist(std::shared_ptr<const vector<double> > dist){
+        empirical_dist = dist;
     }
     double getDistByIndex(int index){
-        return empirical_dist[index];
+        return (*empirical_dist)[index];
     }
     bool hasDist(){
-        return empirical_dist.size() > 0;
+        return empirical_dist && empirical_dist->size() > 0;
     }
     int getDistSize(){
-        return empirical_dist.size();
+        return empirical_dist ? empirical_dist->size() : 0;
     }
     void setDeathRate(double death_rate);
     
@@ -184,6 +282,9 @@ public:
     void addCells(int num, double b);
     // called every time a cell of this type dies
     void subtractOneCell(double b);
+    // called when several cells of this type die at once
+    // b is TOTAL birth rate of the dead cells
+    void subtractCells(int num, double b);
 };
 
 class EndListener{
@@ -250,6 +351,8 @@ private:
     string *model_type;
     int num_simulations;
     int sim_number;
+    // seed of the first trial, set with sim_params seed. -1 to seed from the clock.
+    long long seed;
     vector<int> *has_dist;
     vector<vector<int>> *dists;
     MutationHandler *mut_handler;
@@ -266,6 +369,11 @@ private:
      */
     bool handle_sim_line(vector<string>& parsed_line);
     
+    // true for the simulation types with a constant population size (Moran and Wright-Fisher). their clones use multiplicative fitness effects.
+    bool isConstantSizeModel(){
+        return *model_type == "moran" || *model_type == "moran_slots" || *model_type == "wright_fisher";
+    }
+    
     /* all of the following check the parse line, and if possible, makes and inserts the appropriate object into the simulation
      THEY MAY DESTROY OR MODIFY THE PARSED LINE OBJECT
      @return true iff the object was properly created
@@ -296,6 +404,7 @@ public:
     bool read(ifstream& infile);
     void writeErrors(ofstream& errfile);
     int getNumSims(){return num_simulations;}
+    long long getSeed(){return seed;}
     string getName(){return sim_name;}
     MutationHandler& get_mut_handler(){return *mut_handler;}
     void refreshSim(ifstream& infile);